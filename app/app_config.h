@@ -3,4 +3,6 @@
 #define VERSION_MAJOR		2
 #define VERSION_MINOR		1
 
-#define KEY_FIFO_SIZE		31       // number of keys in the public FIFO
+#ifndef KEY_FIFO_SIZE
+#define KEY_FIFO_SIZE		64       // number of keys in the public FIFO, a power of two
+#endif
@@ -0,0 +1,125 @@
+#include "debounce.h"
+
+#include <sys/types.h>
+
+#define COUNTER_BITS		DEBOUNCE_COUNTER_BITS
+
+// The counters are vertical: bit n of every key's counter lives in cnt[n],
+// so all the keys of the matrix are updated together with word-wide ops.
+static struct
+{
+	uint64_t state;
+	uint64_t cnt[COUNTER_BITS];
+} self;
+
+static uint64_t counter_is_zero(void)
+{
+	uint64_t nonzero = 0;
+	uint i;
+
+	for (i = 0; i < COUNTER_BITS; ++i)
+		nonzero |= self.cnt[i];
+
+	return ~nonzero;
+}
+
+// compares from the top bit down, a counter is at least value when it's ahead on the first bit that differs
+static uint64_t counter_at_least(uint16_t value)
+{
+	uint64_t ahead = 0;
+	uint64_t eq = ~0ull;
+	int i;
+
+	for (i = COUNTER_BITS - 1; i >= 0; --i) {
+		if (value & (1 << i)) {
+			eq &= self.cnt[i];
+		} else {
+			ahead |= eq & self.cnt[i];
+			eq &= ~self.cnt[i];
+		}
+	}
+
+	return ahead | eq;
+}
+
+// counters in mask count up, all others restart from 0
+static void counter_increment(uint64_t mask)
+{
+	uint64_t carry = mask;
+	uint i;
+
+	for (i = 0; i < COUNTER_BITS; ++i) {
+		const uint64_t bit = self.cnt[i];
+
+		self.cnt[i] = (bit ^ carry) & mask;
+		carry &= bit;
+	}
+}
+
+static void counter_decrement(uint64_t mask)
+{
+	uint64_t borrow = mask;
+	uint i;
+
+	for (i = 0; i < COUNTER_BITS; ++i) {
+		const uint64_t bit = self.cnt[i];
+
+		self.cnt[i] = bit ^ borrow;
+		borrow &= ~bit;
+	}
+}
+
+static void counter_load(uint64_t mask, uint16_t value)
+{
+	uint i;
+
+	for (i = 0; i < COUNTER_BITS; ++i)
+		self.cnt[i] = (self.cnt[i] & ~mask) | ((value & (1 << i)) ? mask : 0);
+}
+
+// Report an edge once it was seen on `scans` scans in a row
+static void update_deferred(uint64_t raw, uint16_t scans)
+{
+	const uint64_t diff = raw ^ self.state;
+
+	counter_increment(diff);
+
+	// at least, the period may have gone down since the count started
+	const uint64_t stable = diff & counter_at_least(scans);
+
+	self.state ^= stable;
+	counter_load(stable, 0);
+}
+
+// Report an edge right away, then ignore the key for `scans` - 1 scans
+static void update_eager(uint64_t raw, uint16_t scans)
+{
+	const uint64_t unlocked = counter_is_zero();
+	const uint64_t changed = (raw ^ self.state) & unlocked;
+
+	self.state ^= changed;
+
+	counter_decrement(~unlocked);
+	counter_load(changed, scans - 1);
+}
+
+uint64_t debounce_update(uint64_t raw, uint16_t scans, bool eager)
+{
+	if (scans < 1)
+		scans = 1;
+
+	if (scans > DEBOUNCE_MAX_SCANS)
+		scans = DEBOUNCE_MAX_SCANS;
+
+	if (eager)
+		update_eager(raw, scans);
+	else
+		update_deferred(raw, scans);
+
+	return self.state;
+}
+
+bool debounce_is_settled(void)
+{
+	return (counter_is_zero() == ~0ull);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// every key gets an 11 bit counter, enough for the longest REG_ID_DEB time at the fastest scan rate
+#define DEBOUNCE_COUNTER_BITS	11
+#define DEBOUNCE_MAX_SCANS		((1 << DEBOUNCE_COUNTER_BITS) - 1)
+
+uint64_t debounce_update(uint64_t raw, uint16_t scans, bool eager);
+bool debounce_is_settled(void);
@@ -21,7 +21,7 @@ static void key_cb(uint8_t key, enum key_state state)
 }
 static struct key_callback key_callback = { .func = key_cb };
 
-static void touch_cb(int8_t x, int8_t y)
+static void touch_cb(int16_t x, int16_t y)
 {
 	printf("%s: x: %d, y: %d !\r\n", __func__, x, y);
 }
@@ -72,6 +72,9 @@ static void usb_out_chars(const char *buf, int length)
 	}
 
 	mutex_exit(usb_get_mutex());
+
+	// the USB worker skips tud_task() while we hold the mutex
+	usb_schedule_task();
 }
 static struct stdio_driver stdio_usb =
 {
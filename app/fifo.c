@@ -1,60 +1,95 @@
 #include "app_config.h"
 #include "fifo.h"
 
+#include <hardware/sync.h>
+#include <pico/stdlib.h>
+
+#define FIFO_MASK		(KEY_FIFO_SIZE - 1)
+
+static_assert((KEY_FIFO_SIZE & FIFO_MASK) == 0, "KEY_FIFO_SIZE must be a power of two");
+static_assert(KEY_FIFO_SIZE <= 128, "fifo_count() has to fit in a byte");
+
+// Single producer (key events), consumers on both buses: the I2C IRQ and the
+// USB worker, which it can preempt. The indices run freely and are only masked
+// to address the ring, the producer only ever writes head and the consumers
+// only ever write tail. The producer runs at the same or a higher priority than
+// the consumers, so it is never preempted half way through writing an entry,
+// and the consumers take an entry with interrupts off, so no two get the same one.
 static struct
 {
 	struct fifo_item fifo[KEY_FIFO_SIZE];
-	uint8_t count;
-	uint8_t read_idx;
-	uint8_t write_idx;
+	volatile uint32_t head;
+	volatile uint32_t tail;
 } self;
 
 uint8_t fifo_count(void)
 {
-	return self.count;
+	const uint32_t count = self.head - self.tail;
+
+	// the producer may have lapped the consumer, see fifo_enqueue_force()
+	return MIN(count, KEY_FIFO_SIZE);
 }
 
 void fifo_flush(void)
 {
-	self.write_idx = 0;
-	self.read_idx = 0;
-	self.count = 0;
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	self.tail = self.head;
+
+	restore_interrupts(irq_state);
 }
 
 bool fifo_enqueue(const struct fifo_item item)
 {
-	if (self.count >= KEY_FIFO_SIZE)
+	const uint32_t head = self.head;
+
+	if ((head - self.tail) >= KEY_FIFO_SIZE)
 		return false;
 
-	self.fifo[self.write_idx++] = item;
+	self.fifo[head & FIFO_MASK] = item;
 
-	self.write_idx %= KEY_FIFO_SIZE;
-	++self.count;
+	// publish the entry only once it's written
+	__dmb();
+	self.head = head + 1;
 
 	return true;
 }
 
+// Overwrites the oldest entry when full, without touching tail: the
+// consumer notices it was lapped and skips ahead on its own.
 void fifo_enqueue_force(const struct fifo_item item)
 {
 	if (fifo_enqueue(item))
 		return;
 
-	self.fifo[self.write_idx++] = item;
-	self.write_idx %= KEY_FIFO_SIZE;
+	const uint32_t head = self.head;
+
+	self.fifo[head & FIFO_MASK] = item;
 
-	self.read_idx++;
-	self.read_idx %= KEY_FIFO_SIZE;
+	__dmb();
+	self.head = head + 1;
 }
 
 struct fifo_item fifo_dequeue(void)
 {
 	struct fifo_item item = { 0 };
-	if (self.count == 0)
-		return item;
 
-	item = self.fifo[self.read_idx++];
-	self.read_idx %= KEY_FIFO_SIZE;
-	--self.count;
+	// with interrupts off neither the producer nor the other consumer can get in between
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	const uint32_t head = self.head;
+	uint32_t tail = self.tail;
+
+	if (head != tail) {
+		// lapped by the producer, the oldest entries are gone
+		if ((head - tail) > KEY_FIFO_SIZE)
+			tail = head - KEY_FIFO_SIZE;
+
+		item = self.fifo[tail & FIFO_MASK];
+		self.tail = tail + 1;
+	}
+
+	restore_interrupts(irq_state);
 
 	return item;
 }
@@ -8,6 +8,8 @@ struct fifo_item
 
 	uint8_t _ : 4;
 	enum key_state state : 4;
+
+	uint32_t time_us; // when the event was scanned, see time_us_32()
 };
 
 uint8_t fifo_count(void);
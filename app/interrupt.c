@@ -6,8 +6,158 @@
 #include "reg.h"
 #include "touchpad.h"
 
+#include <hardware/sync.h>
 #include <pico/stdlib.h>
 
+static struct
+{
+	alarm_id_t alarm;
+	absolute_time_t release_time;
+	bool asserted;
+
+	// moderation
+	alarm_id_t moderation_alarm;
+	absolute_time_t first_event_time;
+	absolute_time_t last_int_time;
+	uint8_t pending;
+} self;
+
+static int64_t release_int(alarm_id_t id, void *user_data)
+{
+	(void)id;
+	(void)user_data;
+
+	// another event extended the pulse while we were waiting
+	const int64_t remaining_us = absolute_time_diff_us(get_absolute_time(), self.release_time);
+	if (remaining_us > 0)
+		return -remaining_us;
+
+	gpio_put(PIN_INT, 1);
+	self.alarm = 0;
+
+	return 0;
+}
+
+// Hold INT low for REG_ID_IND ms without blocking, events during a pulse extend it
+static void pulse_int(void)
+{
+	if (reg_is_bit_set(REG_ID_CF2, CF2_INT_LEVEL)) {
+		interrupt_sync();
+		return;
+	}
+
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	self.release_time = make_timeout_time_ms(reg_get_value(REG_ID_IND));
+
+	if (!self.alarm) {
+		gpio_put(PIN_INT, 0);
+
+		self.alarm = add_alarm_at(self.release_time, release_int, NULL, true);
+		if (self.alarm < 0) {
+			gpio_put(PIN_INT, 1);
+			self.alarm = 0;
+		}
+	}
+
+	restore_interrupts(irq_state);
+}
+
+// In level mode, INT is held low for as long as anything is pending in REG_ID_INT or REG_ID_GIN
+void interrupt_sync(void)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	if (reg_is_bit_set(REG_ID_CF2, CF2_INT_LEVEL)) {
+		if (self.alarm) {
+			cancel_alarm(self.alarm);
+			self.alarm = 0;
+		}
+
+		// events still held back by moderation don't assert the line on their own
+		if (!reg_get_value(REG_ID_INT) && !reg_get_value(REG_ID_GIN))
+			self.asserted = false;
+		else if (!self.pending)
+			self.asserted = true;
+
+		gpio_put(PIN_INT, !self.asserted);
+	} else if (!self.alarm) {
+		gpio_put(PIN_INT, 1);
+	}
+
+	restore_interrupts(irq_state);
+}
+
+static void flush_moderation(void)
+{
+	self.pending = 0;
+	self.last_int_time = get_absolute_time();
+
+	pulse_int();
+}
+
+// The batch is due once REG_ID_ICT events are pending or the first one waited REG_ID_IDY ms,
+// but never sooner than REG_ID_IGP ms after the previous interrupt
+static absolute_time_t moderation_deadline(void)
+{
+	const uint8_t threshold = reg_get_value(REG_ID_ICT);
+
+	absolute_time_t deadline = self.first_event_time;
+	if (!threshold || (self.pending < threshold))
+		deadline = delayed_by_ms(deadline, reg_get_value(REG_ID_IDY));
+
+	const absolute_time_t earliest = delayed_by_ms(self.last_int_time, reg_get_value(REG_ID_IGP));
+	if (absolute_time_diff_us(deadline, earliest) > 0)
+		deadline = earliest;
+
+	return deadline;
+}
+
+static int64_t moderation_expired(alarm_id_t id, void *user_data)
+{
+	(void)id;
+	(void)user_data;
+
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	self.moderation_alarm = 0;
+	flush_moderation();
+
+	restore_interrupts(irq_state);
+
+	return 0;
+}
+
+static void raise_int(void)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	if (!self.pending)
+		self.first_event_time = get_absolute_time();
+
+	if (self.pending < UINT8_MAX)
+		self.pending++;
+
+	if (self.moderation_alarm) {
+		cancel_alarm(self.moderation_alarm);
+		self.moderation_alarm = 0;
+	}
+
+	const absolute_time_t deadline = moderation_deadline();
+
+	if (absolute_time_diff_us(get_absolute_time(), deadline) <= 0) {
+		flush_moderation();
+	} else {
+		self.moderation_alarm = add_alarm_at(deadline, moderation_expired, NULL, true);
+		if (self.moderation_alarm < 0) {
+			self.moderation_alarm = 0;
+			flush_moderation();
+		}
+	}
+
+	restore_interrupts(irq_state);
+}
+
 static void key_cb(uint8_t key, enum key_state state)
 {
 	(void)key;
@@ -18,9 +168,7 @@ static void key_cb(uint8_t key, enum key_state state)
 
 	reg_set_bit(REG_ID_INT, INT_KEY);
 
-	gpio_put(PIN_INT, 0);
-	busy_wait_ms(reg_get_value(REG_ID_IND));
-	gpio_put(PIN_INT, 1);
+	raise_int();
 }
 static struct key_callback key_callback = { .func = key_cb };
 
@@ -38,14 +186,11 @@ static void key_lock_cb(bool caps_changed, bool num_changed)
 		do_int = true;
 	}
 
-	if (do_int) {
-		gpio_put(PIN_INT, 0);
-		busy_wait_ms(reg_get_value(REG_ID_IND));
-		gpio_put(PIN_INT, 1);
-	}
+	if (do_int)
+		raise_int();
 }
 
-static void touch_cb(int8_t x, int8_t y)
+static void touch_cb(int16_t x, int16_t y)
 {
 	(void)x;
 	(void)y;
@@ -55,9 +200,7 @@ static void touch_cb(int8_t x, int8_t y)
 
 	reg_set_bit(REG_ID_INT, INT_TOUCH);
 
-	gpio_put(PIN_INT, 0);
-	busy_wait_ms(reg_get_value(REG_ID_IND));
-	gpio_put(PIN_INT, 1);
+	raise_int();
 }
 static struct touch_callback touch_callback = { .func = touch_cb };
 
@@ -71,9 +214,7 @@ static void gpioexp_cb(uint8_t gpio, uint8_t gpio_idx)
 	reg_set_bit(REG_ID_INT, INT_GPIO);
 	reg_set_bit(REG_ID_GIN, (1 << gpio_idx));
 
-	gpio_put(PIN_INT, 0);
-	busy_wait_ms(reg_get_value(REG_ID_IND));
-	gpio_put(PIN_INT, 1);
+	raise_int();
 }
 static struct gpioexp_callback gpioexp_callback = { .func = gpioexp_cb };
 
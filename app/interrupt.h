@@ -1,3 +1,5 @@
 #pragma once
 
+void interrupt_sync(void);
+
 void interrupt_init(void);
@@ -1,17 +1,58 @@
 #include "app_config.h"
+#include "debounce.h"
 #include "fifo.h"
 #include "keyboard.h"
 #include "reg.h"
 #include "pi.h"
 
+#include "keyboard.pio.h"
+
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/pio.h>
 #include <pico/stdlib.h>
 
 // Size of the list keeping track of all the pressed keys
 #define MAX_TRACKED_KEYS 10
 
+// The packed matrix has a byte per column, the row pins have to fit in it
+#define MATRIX_COL_STRIDE	8
+
 static struct
 {
 	struct key_callback *key_callbacks;
+
+	PIO pio;
+	uint sm;
+	uint dma_tx;
+	uint dma_rx;
+	uint offset;
+	uint row_base;
+	uint32_t row_bits;
+	uint32_t col_mask;
+	uint32_t wake_mask;
+
+	// columns held low and rows armed for an edge, instead of scanning
+	bool idle;
+	uint32_t last_activity_ms;
+
+	// time between two frames, picked by the governor
+	uint32_t period_us;
+
+	// when the frame being handled was scanned
+	uint32_t scan_time_us;
+
+	// per column: pindirs mask, delay after the column (in us)
+	uint32_t col_cmds[NUM_OF_COLS * 2];
+
+	// row samples, one word per column, the first bit is row_base
+	uint32_t rows[NUM_OF_COLS];
+
+	// the previous frame, packed like the matrix
+	uint64_t last_raw;
+
+	// matrix bits of the holdable modifiers
+	uint64_t hold_bits;
 } self;
 
 // Key and buttons definitions
@@ -42,7 +83,10 @@ static const uint8_t kbd_entries[NUM_OF_ROWS][NUM_OF_COLS] =
 , {     KEY_ESC, KEY_LEFTALT, KEY_V, KEY_X, KEY_MUTE, KEY_B }
 , {         0x0, KEY_A, KEY_RIGHTSHIFT, KEY_P, KEY_BACKSPACE, KEY_ENTER }
 };
-static bool kbd_pressed_state[NUM_OF_ROWS][NUM_OF_COLS] = {};
+
+// Both indexed by packed matrix bit, see matrix_bit()
+static uint8_t kbd_keycodes[64];
+static uint64_t kbd_pressed_state;
 
 #if NUM_OF_BTNS > 0
 
@@ -53,6 +97,30 @@ static const uint8_t btn_pins[NUM_OF_BTNS] = { 4 };
 
 #pragma GCC diagnostic pop
 
+static void inject_event(uint8_t key, enum key_state state, uint32_t time_us)
+{
+	struct fifo_item item;
+	item.scancode = key;
+	item.state = state;
+	item.time_us = time_us;
+
+	if (!fifo_enqueue(item)) {
+		if (reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_INT)) {
+			reg_set_bit(REG_ID_INT, INT_OVERFLOW);
+		}
+
+		if (reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_ON)) {
+			fifo_enqueue_force(item);
+		}
+	}
+
+	struct key_callback *cb = self.key_callbacks;
+	while (cb) {
+		cb->func(key, state);
+		cb = cb->next;
+	}
+}
+
 struct hold_key
 {
 	uint8_t keycode;
@@ -176,14 +244,14 @@ static bool handle_hold_key_event(struct hold_key* hold_key, enum key_state* sta
 	return false;
 }
 
-static void handle_key_event(uint r, uint c, bool pressed)
+static void handle_key_event(uint bit, bool pressed)
 {
 	uint8_t keycode;
 	bool send_update = false;
 	enum key_state state;
 
 	// Get keycode
-	keycode = kbd_entries[r][c];
+	keycode = kbd_keycodes[bit];
 
 	// Don't send power key over USB
 	if ((keycode == 0) || (keycode == KEY_POWER)) {
@@ -205,8 +273,7 @@ static void handle_key_event(uint r, uint c, bool pressed)
 
 	// Basic press / release alpha key
 	} else {
-		send_update = (kbd_pressed_state[r][c] != pressed);
-		kbd_pressed_state[r][c] = pressed;
+		send_update = (((kbd_pressed_state >> bit) & 1) != pressed);
 		state = (pressed) ? KEY_STATE_PRESSED : KEY_STATE_RELEASED;
 	}
 
@@ -216,30 +283,175 @@ static void handle_key_event(uint r, uint c, bool pressed)
 	}
 
 	// Report key to input system
-	keyboard_inject_event(keycode, state);
+	inject_event(keycode, state, self.scan_time_us);
 }
 
-static int64_t timer_task(alarm_id_t id, void *user_data)
+static inline uint64_t matrix_bit(uint r, uint c)
 {
-	(void)id;
-	(void)user_data;
-	uint c, r, i;
-	bool pressed;
+	return (1ull << ((c * MATRIX_COL_STRIDE) + (row_pins[r] - self.row_base)));
+}
 
-	for (c = 0; c < NUM_OF_COLS; c++) {
-		gpio_pull_up(col_pins[c]);
-		gpio_put(col_pins[c], 0);
-		gpio_set_dir(col_pins[c], GPIO_OUT);
+static bool hold_keys_idle(void)
+{
+	return (left_shift_hold_key.state == KEY_STATE_IDLE)
+		&& (right_shift_hold_key.state == KEY_STATE_IDLE)
+		&& (phys_alt_hold_key.state == KEY_STATE_IDLE)
+		&& (sym_hold_key.state == KEY_STATE_IDLE);
+}
 
-		for (r = 0; r < NUM_OF_ROWS; r++) {
-			pressed = (gpio_get(row_pins[r]) == 0);
-			handle_key_event(r, c, pressed);
-		}
+static uint32_t scan_period_us(void)
+{
+	const uint32_t scan_us = NUM_OF_COLS * keyboard_matrix_slot_cycles;
 
-		gpio_put(col_pins[c], 1);
-		gpio_disable_pulls(col_pins[c]);
-		gpio_set_dir(col_pins[c], GPIO_IN);
+	return MAX(self.period_us, scan_us);
+}
+
+// Scan at the fastest rate while keys are in use, then back off towards the slowest rate
+static void governor_update(bool active)
+{
+	const uint32_t min_us = reg_get_value(REG_ID_SMN) * 100;
+	const uint32_t max_us = MAX(reg_get_value(REG_ID_SMX) * 100, min_us);
+
+	if (active)
+		self.period_us = min_us;
+	else	// from the real interval, a REG_ID_SMN of 0 would otherwise keep doubling 0
+		self.period_us = MIN(MAX(scan_period_us() * 2, min_us), max_us);
+
+	const uint32_t period_us = scan_period_us();
+	reg_set_value(REG_ID_SCI, MIN((period_us + 99) / 100, UINT8_MAX));
+}
+
+static_assert((DEB_TIME_MASK * 1000) / (NUM_OF_COLS * keyboard_matrix_slot_cycles) < DEBOUNCE_MAX_SCANS,
+	"the debounce counters are too short for the longest REG_ID_DEB time");
+
+// Number of scans that cover the REG_ID_DEB debounce time
+static uint16_t debounce_scans(void)
+{
+	const uint32_t debounce_us = (reg_get_value(REG_ID_DEB) & DEB_TIME_MASK) * 1000;
+	const uint32_t period_us = scan_period_us();
+
+	return (debounce_us + period_us - 1) / period_us;
+}
+
+static void scan_start(void)
+{
+	const uint32_t scan_us = NUM_OF_COLS * keyboard_matrix_slot_cycles;
+
+	// the previous frame's commands might still be on their way to the FIFO
+	dma_channel_wait_for_finish_blocking(self.dma_tx);
+
+	// the delay after the last column paces the frames
+	self.col_cmds[NUM_OF_COLS * 2 - 1] = scan_period_us() - scan_us;
+
+	dma_channel_set_write_addr(self.dma_rx, self.rows, true);
+	dma_channel_set_read_addr(self.dma_tx, self.col_cmds, true);
+}
+
+static void set_wake_irqs_enabled(bool enabled)
+{
+	uint i;
+
+	for (i = 0; i < NUM_OF_ROWS; ++i) {
+		gpio_acknowledge_irq(row_pins[i], GPIO_IRQ_EDGE_FALL);
+		gpio_set_irq_enabled(row_pins[i], GPIO_IRQ_EDGE_FALL, enabled);
+	}
+
+#if NUM_OF_BTNS > 0
+	for (i = 0; i < NUM_OF_BTNS; ++i) {
+		gpio_acknowledge_irq(btn_pins[i], GPIO_IRQ_EDGE_FALL);
+		gpio_set_irq_enabled(btn_pins[i], GPIO_IRQ_EDGE_FALL, enabled);
 	}
+#endif
+}
+
+static bool wake_pins_asserted(void)
+{
+	uint i;
+
+	for (i = 0; i < NUM_OF_ROWS; ++i) {
+		if (gpio_get(row_pins[i]) == 0)
+			return true;
+	}
+
+#if NUM_OF_BTNS > 0
+	for (i = 0; i < NUM_OF_BTNS; ++i) {
+		if (gpio_get(btn_pins[i]) == 0)
+			return true;
+	}
+#endif
+
+	return false;
+}
+
+static void scan_resume(void)
+{
+	set_wake_irqs_enabled(false);
+
+	// release the columns and let the state machine take over again
+	pio_sm_set_pindirs_with_mask(self.pio, self.sm, 0, self.col_mask);
+	pio_sm_set_enabled(self.pio, self.sm, true);
+
+	self.idle = false;
+	self.last_activity_ms = to_ms_since_boot(get_absolute_time());
+
+	governor_update(true);
+	scan_start();
+}
+
+static void scan_suspend(void)
+{
+	// aborting with the IRQ enabled can raise a spurious completion (RP2040-E13)
+	dma_channel_set_irq0_enabled(self.dma_rx, false);
+	dma_channel_abort(self.dma_tx);
+	dma_channel_abort(self.dma_rx);
+	dma_hw->ints0 = (1u << self.dma_rx);
+	dma_channel_set_irq0_enabled(self.dma_rx, true);
+
+	pio_sm_set_enabled(self.pio, self.sm, false);
+	pio_sm_clear_fifos(self.pio, self.sm);
+	pio_sm_restart(self.pio, self.sm);
+	pio_sm_exec(self.pio, self.sm, pio_encode_jmp(self.offset));
+
+	// all columns low, so any key pulls its row down
+	pio_sm_set_pindirs_with_mask(self.pio, self.sm, self.col_mask, self.col_mask);
+
+	self.idle = true;
+	set_wake_irqs_enabled(true);
+
+	// a key that went down before the IRQs were armed has no edge left to report
+	if (wake_pins_asserted())
+		scan_resume();
+}
+
+// called once the DMA has written a full frame of row samples
+// This runs on every frame while the matrix is scanned, including while any key is held, even when the
+// frame matches the previous one. Only raising it on a change isn't possible: PIO has only X and Y to
+// compare a 42-bit frame against, and the DMA has no strided writes to feed the last frame back.
+// The debouncer and the hold timers need every frame anyway. Instead the governor backs off to
+// REG_ID_SMX while nothing changes, and the REG_ID_IDL suspend stops the DMA once no key is down.
+static void dma_irq_handler(void)
+{
+	uint64_t raw = 0;
+	uint c, i;
+	bool pressed;
+
+	dma_hw->ints0 = (1u << self.dma_rx);
+
+	self.scan_time_us = time_us_32();
+
+	// the rows are pulled up, so a pressed key reads as 0
+	for (c = 0; c < NUM_OF_COLS; c++)
+		raw |= (uint64_t)(~self.rows[c] & self.row_bits) << (c * MATRIX_COL_STRIDE);
+
+	// a key held down steadily doesn't need the fast rate, only changes and hold timers do
+	const bool active = (raw != self.last_raw) || !debounce_is_settled() || !hold_keys_idle()
+		|| (power_hold_key.state != KEY_STATE_IDLE);
+
+	self.last_raw = raw;
+
+	// the period has to be known before re-arming for the next frame
+	governor_update(active);
+	scan_start();
 
 #if NUM_OF_BTNS > 0
 	for (i = 0; i < NUM_OF_BTNS; i++) {
@@ -248,31 +460,139 @@ static int64_t timer_task(alarm_id_t id, void *user_data)
 	}
 #endif
 
-	// negative value means interval since last alarm time
-	return -(reg_get_value(REG_ID_FRQ) * 1000);
+	const uint64_t matrix = debounce_update(raw, debounce_scans(), reg_is_bit_set(REG_ID_DEB, DEB_EAGER));
+
+	// Only visit the keys that changed, held keys need every frame to advance to the hold states
+	uint64_t visit = matrix ^ kbd_pressed_state;
+	if (!hold_keys_idle())
+		visit |= self.hold_bits;
+
+	while (visit) {
+		const uint bit = __builtin_ctzll(visit);
+		visit &= (visit - 1);
+
+		handle_key_event(bit, (matrix >> bit) & 1);
+	}
+
+	kbd_pressed_state = matrix;
+
+	const uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+
+	if (active || matrix || (power_hold_key.state != KEY_STATE_IDLE)) {
+		self.last_activity_ms = now_ms;
+	} else if (reg_get_value(REG_ID_IDL)
+		&& ((now_ms - self.last_activity_ms) >= (reg_get_value(REG_ID_IDL) * 10u))) {
+		scan_suspend();
+	}
 }
 
-void keyboard_inject_event(uint8_t key, enum key_state state)
+static void scan_init(void)
 {
-	struct fifo_item item;
-	item.scancode = key;
-	item.state = state;
+	uint col_base = col_pins[0];
+	uint col_last = col_pins[0];
+	uint r, c, i;
 
-	if (!fifo_enqueue(item)) {
-		if (reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_INT)) {
-			reg_set_bit(REG_ID_INT, INT_OVERFLOW);
-		}
+	self.row_base = row_pins[0];
+	for (i = 1; i < NUM_OF_ROWS; ++i)
+		self.row_base = MIN(self.row_base, row_pins[i]);
 
-		if (reg_is_bit_set(REG_ID_CFG, CFG_OVERFLOW_ON)) {
-			fifo_enqueue_force(item);
+	for (i = 0; i < NUM_OF_ROWS; ++i) {
+		self.row_bits |= (1u << (row_pins[i] - self.row_base));
+		self.wake_mask |= (1u << row_pins[i]);
+	}
+
+	if (self.row_bits >= (1u << MATRIX_COL_STRIDE))
+		panic("row pins don't fit in a matrix column");
+
+	for (c = 0; c < NUM_OF_COLS; ++c) {
+		for (r = 0; r < NUM_OF_ROWS; ++r) {
+			const uint8_t keycode = kbd_entries[r][c];
+			const uint64_t bit = matrix_bit(r, c);
+
+			kbd_keycodes[__builtin_ctzll(bit)] = keycode;
+
+			if ((keycode == KEY_LEFTSHIFT) || (keycode == KEY_RIGHTSHIFT)
+				|| (keycode == KEY_LEFTALT) || (keycode == KEY_RIGHTALT)) {
+				self.hold_bits |= bit;
+			}
 		}
 	}
 
-	struct key_callback *cb = self.key_callbacks;
-	while (cb) {
-		cb->func(key, state);
-		cb = cb->next;
+#if NUM_OF_BTNS > 0
+	for (i = 0; i < NUM_OF_BTNS; ++i)
+		self.wake_mask |= (1u << btn_pins[i]);
+#endif
+
+	for (i = 1; i < NUM_OF_COLS; ++i) {
+		col_base = MIN(col_base, col_pins[i]);
+		col_last = MAX(col_last, col_pins[i]);
+	}
+
+	// Other pins in the column range are not switched to PIO, so the masks don't touch them
+	for (i = 0; i < NUM_OF_COLS; ++i) {
+		self.col_cmds[i * 2] = (1u << (col_pins[i] - col_base));
+		self.col_cmds[i * 2 + 1] = 0;
+
+		self.col_mask |= (1u << col_pins[i]);
 	}
+
+	self.pio = pio0;
+	self.sm = pio_claim_unused_sm(self.pio, true);
+
+	self.offset = pio_add_program(self.pio, &keyboard_matrix_program);
+	keyboard_matrix_program_init(self.pio, self.sm, self.offset, col_base, col_last - col_base + 1, self.row_base);
+
+	// columns only ever sink, released they float
+	pio_sm_set_pins_with_mask(self.pio, self.sm, 0, self.col_mask);
+	pio_sm_set_pindirs_with_mask(self.pio, self.sm, 0, self.col_mask);
+	for (i = 0; i < NUM_OF_COLS; ++i) {
+		gpio_disable_pulls(col_pins[i]);
+		pio_gpio_init(self.pio, col_pins[i]);
+	}
+
+	self.dma_tx = dma_claim_unused_channel(true);
+	self.dma_rx = dma_claim_unused_channel(true);
+
+	dma_channel_config config = dma_channel_get_default_config(self.dma_tx);
+	channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+	channel_config_set_read_increment(&config, true);
+	channel_config_set_write_increment(&config, false);
+	channel_config_set_dreq(&config, pio_get_dreq(self.pio, self.sm, true));
+	dma_channel_configure(self.dma_tx, &config, &self.pio->txf[self.sm], self.col_cmds, count_of(self.col_cmds), false);
+
+	config = dma_channel_get_default_config(self.dma_rx);
+	channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+	channel_config_set_read_increment(&config, false);
+	channel_config_set_write_increment(&config, true);
+	channel_config_set_dreq(&config, pio_get_dreq(self.pio, self.sm, false));
+	dma_channel_configure(self.dma_rx, &config, self.rows, &self.pio->rxf[self.sm], count_of(self.rows), false);
+
+	dma_channel_set_irq0_enabled(self.dma_rx, true);
+	irq_set_exclusive_handler(DMA_IRQ_0, dma_irq_handler);
+	irq_set_enabled(DMA_IRQ_0, true);
+
+	pio_sm_set_enabled(self.pio, self.sm, true);
+
+	self.last_activity_ms = to_ms_since_boot(get_absolute_time());
+
+	governor_update(true);
+	scan_start();
+}
+
+void keyboard_inject_event(uint8_t key, enum key_state state)
+{
+	inject_event(key, state, time_us_32());
+}
+
+void keyboard_gpio_irq(uint gpio, uint32_t events)
+{
+	if (!self.idle || !(events & GPIO_IRQ_EDGE_FALL))
+		return;
+
+	if (!(self.wake_mask & (1u << gpio)))
+		return;
+
+	scan_resume();
 }
 
 void keyboard_add_key_callback(struct key_callback *callback)
@@ -302,12 +622,6 @@ void keyboard_init(void)
 		gpio_set_dir(row_pins[i], GPIO_IN);
 	}
 
-	// GPIO columns
-	for(i = 0; i < NUM_OF_COLS; ++i) {
-		gpio_init(col_pins[i]);
-		gpio_set_dir(col_pins[i], GPIO_IN);
-	}
-
 	// GPIO buttons
 #if NUM_OF_BTNS > 0
 	for(i = 0; i < NUM_OF_BTNS; ++i) {
@@ -329,5 +643,5 @@ void keyboard_init(void)
 	sym_hold_key.keycode = KEY_RIGHTALT;
 	sym_hold_key.state = KEY_STATE_IDLE;
 
-	add_alarm_in_ms(reg_get_value(REG_ID_FRQ), timer_task, NULL, true);
+	scan_init();
 }
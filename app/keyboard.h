@@ -4,6 +4,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 enum key_state
 {
@@ -24,6 +25,8 @@ struct key_callback
 
 void keyboard_inject_event(uint8_t key, enum key_state state);
 
+void keyboard_gpio_irq(uint gpio, uint32_t events);
+
 void keyboard_add_key_callback(struct key_callback *callback);
 
 void keyboard_init(void);
@@ -19,6 +19,7 @@
 static void gpio_irq(uint gpio, uint32_t events)
 {
 //	printf("%s: gpio %d, events 0x%02X\r\n", __func__, gpio, events);
+	keyboard_gpio_irq(gpio, events);
 	touchpad_gpio_irq(gpio, events);
 	gpioexp_gpio_irq(gpio, events);
 }
@@ -3,17 +3,12 @@
 #include "keyboard.h"
 #include "gpioexp.h"
 #include "backlight.h"
-#include "hardware/adc.h"
 #include <hardware/pwm.h>
 
 #include <pico/stdlib.h>
 
 void pi_power_init(void)
 {
-	adc_init();
-	adc_gpio_init(PIN_BAT_ADC);
-	adc_select_input(0);
-
 	gpio_init(PIN_PI_PWR);
 	gpio_set_dir(PIN_PI_PWR, GPIO_OUT);
 }
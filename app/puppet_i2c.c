@@ -7,6 +7,15 @@
 #include <pico/stdlib.h>
 
 #define REG_ID_INVALID		0x00
+#define REG_ID_END			0x7F // block writes that reach a register with side effects stop here
+
+#define TX_FIFO_DEPTH		16
+
+// a whole reply is queued at once, the IRQ never waits for the bus to drain
+static_assert(PACKET_OUT_MAX <= TX_FIFO_DEPTH, "a reply has to fit in the TX FIFO");
+
+static_assert((PUPPET_I2C_BAUDRATE >= I2C_SPEED_MIN * I2C_SPEED_UNIT) && (PUPPET_I2C_BAUDRATE <= I2C_SPEED_MAX * I2C_SPEED_UNIT),
+	"PUPPET_I2C_BAUDRATE is out of range");
 
 static i2c_inst_t *i2c_instances[2] = { i2c0, i2c1 };
 
@@ -20,26 +29,41 @@ static struct
 		uint8_t data;
 	} read_buffer;
 
-	uint8_t write_buffer[2];
+	uint8_t write_buffer[PACKET_OUT_MAX];
 	uint8_t write_len;
+
+	// last register read, and whether its reply was already sent
+	uint8_t write_reg;
+	bool write_sent;
+
+	// a reply was sent in this transaction, more reads move on to the next register
+	bool reading;
+
+	// REG_ID_PBR changed, applied once the current transaction is over
+	bool baudrate_changed;
 } self;
 
-static void irq_handler(void)
+static void receive_byte(uint32_t data_cmd)
 {
-	// the controller sent data
-	if (self.i2c->hw->intr_stat & I2C_IC_INTR_MASK_M_RX_FULL_BITS) {
-		if (self.read_buffer.reg == REG_ID_INVALID) {
-			self.read_buffer.reg = self.i2c->hw->data_cmd & 0xff;
-
-			if (self.read_buffer.reg & PACKET_WRITE_MASK) {
-				// it'sq a reg write, we need to wait for the second byte before we process
-				return;
-			}
-		} else {
-			self.read_buffer.data = self.i2c->hw->data_cmd & 0xff;
+	const uint8_t data = data_cmd & 0xff;
+
+	// every transaction starts with a register
+	if (data_cmd & I2C_IC_DATA_CMD_FIRST_DATA_BYTE_BITS)
+		self.read_buffer.reg = REG_ID_INVALID;
+
+	if (self.read_buffer.reg == REG_ID_INVALID) {
+		self.read_buffer.reg = data;
+
+		if (self.read_buffer.reg & PACKET_WRITE_MASK) {
+			// it's a reg write, we need to wait for the data bytes before we process
+			return;
 		}
 
-		reg_process_packet(self.read_buffer.reg, self.read_buffer.data, self.write_buffer, &self.write_len);
+		reg_process_packet(self.read_buffer.reg, 0, self.write_buffer, &self.write_len);
+
+		self.write_reg = self.read_buffer.reg;
+		self.write_sent = false;
+		self.reading = false;
 
 		// ready for the next operation
 		self.read_buffer.reg = REG_ID_INVALID;
@@ -47,12 +71,80 @@ static void irq_handler(void)
 		return;
 	}
 
+	if (self.read_buffer.reg == (REG_ID_END | PACKET_WRITE_MASK))
+		return;
+
+	self.read_buffer.data = data;
+
+	reg_process_packet(self.read_buffer.reg, self.read_buffer.data, self.write_buffer, &self.write_len);
+
+	self.write_reg = self.read_buffer.reg;
+	self.write_sent = false;
+
+	// more data bytes go to the following registers
+	const uint8_t next = (self.read_buffer.reg & ~PACKET_WRITE_MASK) + 1;
+	self.read_buffer.reg = (reg_is_sequential(next) ? next : REG_ID_END) | PACKET_WRITE_MASK;
+}
+
+static void next_reply(void)
+{
+	if (reg_is_streaming(self.write_reg)) {
+		reg_process_packet(self.write_reg, 0, self.write_buffer, &self.write_len);
+		return;
+	}
+
+	if (self.write_reg < REG_ID_LAST)
+		self.write_reg++;
+
+	self.write_len = 0;
+	if (reg_is_sequential(self.write_reg))
+		reg_process_packet(self.write_reg, 0, self.write_buffer, &self.write_len);
+
+	// gaps in the register map, and registers with side effects, read as zero
+	if (self.write_len == 0) {
+		self.write_buffer[0] = 0x00;
+		self.write_len = sizeof(uint8_t);
+	}
+}
+
+static void irq_handler(void)
+{
+	const uint32_t status = self.i2c->hw->intr_stat;
+
+	// the controller sent data
+	while (i2c_get_read_available(self.i2c))
+		receive_byte(self.i2c->hw->data_cmd);
+
+	// a new read transaction starts over at the selected register
+	if (status & I2C_IC_INTR_STAT_R_STOP_DET_BITS) {
+		self.i2c->hw->clr_stop_det;
+		self.reading = false;
+
+		// changing the speed disables the block, which would cut the transaction short
+		if (self.baudrate_changed) {
+			i2c_set_baudrate(self.i2c, reg_get_value(REG_ID_PBR) * I2C_SPEED_UNIT);
+			self.baudrate_changed = false;
+		}
+	}
+
+	// the controller read less than a whole reply, the rest was flushed and the FIFO stays locked until this is cleared
+	if (status & I2C_IC_INTR_STAT_R_TX_ABRT_BITS)
+		self.i2c->hw->clr_tx_abrt;
+
 	// the controller requested a read
-	if (self.i2c->hw->intr_stat & I2C_IC_INTR_MASK_M_RD_REQ_BITS) {
-		i2c_write_raw_blocking(self.i2c, self.write_buffer, self.write_len);
+	if (status & I2C_IC_INTR_STAT_R_RD_REQ_BITS) {
+		// the controller keeps reading, fetch the next reply only now so nothing is popped for nothing
+		if (self.write_sent && (self.reading || reg_is_streaming(self.write_reg)))
+			next_reply();
+
+		// the reply was prepared when the register was selected, queue all of it in one go
+		for (uint8_t i = 0; i < self.write_len; ++i)
+			self.i2c->hw->data_cmd = self.write_buffer[i];
+
+		self.write_sent = true;
+		self.reading = true;
 
 		self.i2c->hw->clr_rd_req;
-		return;
 	}
 }
 
@@ -61,12 +153,17 @@ void puppet_i2c_sync_address(void)
 	i2c_set_slave_mode(self.i2c, true, reg_get_value(REG_ID_ADR));
 }
 
+void puppet_i2c_sync_baudrate(void)
+{
+	self.baudrate_changed = true;
+}
+
 void puppet_i2c_init(void)
 {
 	// determine the instance based on SCL pin, hope you didn't screw up the SDA pin!
 	self.i2c = i2c_instances[(PIN_PUPPET_SCL / 2) % 2];
 
-	i2c_init(self.i2c, 100 * 1000);
+	i2c_init(self.i2c, reg_get_value(REG_ID_PBR) * I2C_SPEED_UNIT);
 	puppet_i2c_sync_address();
 
 	gpio_set_function(PIN_PUPPET_SDA, GPIO_FUNC_I2C);
@@ -75,8 +172,9 @@ void puppet_i2c_init(void)
 	gpio_set_function(PIN_PUPPET_SCL, GPIO_FUNC_I2C);
 	gpio_pull_up(PIN_PUPPET_SCL);
 
-	// irq when the controller sends data, and when it requests a read
-	self.i2c->hw->intr_mask = I2C_IC_INTR_MASK_M_RD_REQ_BITS | I2C_IC_INTR_MASK_M_RX_FULL_BITS;
+	// irq when the controller sends data, when it requests a read, when it stops reading early, and at the end of a transaction
+	self.i2c->hw->intr_mask = I2C_IC_INTR_MASK_M_RD_REQ_BITS | I2C_IC_INTR_MASK_M_RX_FULL_BITS |
+		I2C_IC_INTR_MASK_M_TX_ABRT_BITS | I2C_IC_INTR_MASK_M_STOP_DET_BITS;
 
 	const int irq = I2C0_IRQ + i2c_hw_index(self.i2c);
 	irq_set_exclusive_handler(irq, irq_handler);
@@ -1,5 +1,6 @@
 #pragma once
 
 void puppet_i2c_sync_address(void);
+void puppet_i2c_sync_baudrate(void);
 
 void puppet_i2c_init(void);
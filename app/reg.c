@@ -4,6 +4,7 @@
 #include "backlight.h"
 #include "fifo.h"
 #include "gpioexp.h"
+#include "interrupt.h"
 #include "puppet_i2c.h"
 #include "keyboard.h"
 #include "touchpad.h"
@@ -11,6 +12,8 @@
 #include "hardware/adc.h"
 #include "rtc.h"
 
+#include <hardware/irq.h>
+#include <hardware/sync.h>
 #include <pico/stdlib.h>
 #include <RP2040.h> // TODO: When there's more than one RP chip, change this to be more generic
 #include <stdio.h>
@@ -18,206 +21,436 @@
 // We don't enable this by default cause it spams quite a lot
 //#define DEBUG_REGS
 
+#define REG_WORKER_IRQ				30
+
+#define WRITE_QUEUE_SIZE			32
+#define WRITE_QUEUE_MASK			(WRITE_QUEUE_SIZE - 1)
+
+static_assert((WRITE_QUEUE_SIZE & WRITE_QUEUE_MASK) == 0, "WRITE_QUEUE_SIZE must be a power of two");
+
 static struct
 {
 	uint8_t regs[REG_ID_LAST];
+
+	// writes waiting for the worker
+	struct
+	{
+		uint8_t reg;
+		uint8_t data;
+	} writes[WRITE_QUEUE_SIZE];
+	uint32_t writes_head;
+	uint32_t writes_tail;
+
+	// wide touch deltas for REG_ID_TXY
+	int16_t touch_x;
+	int16_t touch_y;
+	bool touch_overflow;
 } self;
 
-static void touch_cb(int8_t x, int8_t y)
+static int16_t add_delta(int16_t acc, int16_t delta, bool *overflow)
+{
+	const int32_t sum = acc + delta;
+
+	if ((sum < INT16_MIN) || (sum > INT16_MAX)) {
+		*overflow = true;
+		return MAX(INT16_MIN, MIN(sum, INT16_MAX));
+	}
+
+	return sum;
+}
+
+static void touch_cb(int16_t x, int16_t y)
 {
-	const int16_t dx = (int8_t)self.regs[REG_ID_TOX] + x;
-	const int16_t dy = (int8_t)self.regs[REG_ID_TOY] + y;
+	const int32_t dx = (int8_t)self.regs[REG_ID_TOX] + x;
+	const int32_t dy = (int8_t)self.regs[REG_ID_TOY] + y;
 
 	// bind to -128 to 127
 	self.regs[REG_ID_TOX] = MAX(INT8_MIN, MIN(dx, INT8_MAX));
 	self.regs[REG_ID_TOY] = MAX(INT8_MIN, MIN(dy, INT8_MAX));
+
+	self.touch_x = add_delta(self.touch_x, x, &self.touch_overflow);
+	self.touch_y = add_delta(self.touch_y, y, &self.touch_overflow);
 }
 static struct touch_callback touch_callback = { .func = touch_cb };
 
-void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, uint8_t *out_len)
+// read hooks fill in the reply, whose length comes from the map
+static void read_value(uint8_t reg, uint8_t *out_buffer)
+{
+	out_buffer[0] = reg_get_value(reg);
+}
+
+static void read_version(uint8_t reg, uint8_t *out_buffer)
+{
+	(void)reg;
+
+	out_buffer[0] = VER_VAL;
+}
+
+// in level mode a read clears the bits it returned
+static void read_status(uint8_t reg, uint8_t *out_buffer)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	out_buffer[0] = reg_get_value(reg);
+
+	if (reg_is_bit_set(REG_ID_CF2, CF2_INT_LEVEL))
+		reg_clear_bit(reg, out_buffer[0]);
+
+	restore_interrupts(irq_state);
+
+	interrupt_sync();
+}
+
+static void read_key_status(uint8_t reg, uint8_t *out_buffer)
+{
+	(void)reg;
+
+	out_buffer[0] = MIN(fifo_count(), KEY_COUNT_MASK);
+}
+
+static void read_fifo(uint8_t reg, uint8_t *out_buffer)
+{
+	(void)reg;
+
+	struct fifo_item item = fifo_dequeue();
+
+	out_buffer[0] = ((uint8_t*)&item)[0];
+	out_buffer[1] = ((uint8_t*)&item)[1];
+}
+
+static void read_fifo_time(uint8_t reg, uint8_t *out_buffer)
+{
+	(void)reg;
+
+	struct fifo_item item = fifo_dequeue();
+
+	out_buffer[0] = ((uint8_t*)&item)[0];
+	out_buffer[1] = ((uint8_t*)&item)[1];
+	out_buffer[2] = (uint8_t)(item.time_us & 0xFF);
+	out_buffer[3] = (uint8_t)((item.time_us >> 8) & 0xFF);
+	out_buffer[4] = (uint8_t)((item.time_us >> 16) & 0xFF);
+	out_buffer[5] = (uint8_t)((item.time_us >> 24) & 0xFF);
+}
+
+static void read_gpio(uint8_t reg, uint8_t *out_buffer)
+{
+	(void)reg;
+
+	out_buffer[0] = gpioexp_get_value();
+}
+
+// sampled on the read, a conversion takes 96 ADC clocks (2us) so it's fine in the bus IRQ
+static void read_adc(uint8_t reg, uint8_t *out_buffer)
+{
+	(void)reg;
+
+	// the USB worker can be preempted by the I2C IRQ halfway through a conversion
+	const uint32_t irq_state = save_and_disable_interrupts();
+	const uint16_t value = adc_read();
+	restore_interrupts(irq_state);
+
+	out_buffer[0] = (uint8_t)(value & 0x00FF);
+	out_buffer[1] = (uint8_t)((value & 0xFF00) >> 8);
+}
+
+static void read_rtc(uint8_t reg, uint8_t *out_buffer)
+{
+	out_buffer[0] = rtc_get(reg);
+}
+
+static void read_snapshot(uint8_t reg, uint8_t *out_buffer)
+{
+	(void)reg;
+
+	// latch everything at once, so no event lands between two of the fields
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	out_buffer[0] = reg_get_value(REG_ID_INT);
+	out_buffer[1] = MIN(fifo_count(), KEY_COUNT_MASK);
+	out_buffer[2] = reg_get_value(REG_ID_TOX);
+	out_buffer[3] = reg_get_value(REG_ID_TOY);
+	out_buffer[4] = reg_get_value(REG_ID_GIN);
+
+	reg_set_value(REG_ID_TOX, 0);
+	reg_set_value(REG_ID_TOY, 0);
+
+	if (reg_is_bit_set(REG_ID_CF2, CF2_SNAPSHOT_CLR | CF2_INT_LEVEL)) {
+		reg_clear_bit(REG_ID_INT, out_buffer[0]);
+		reg_clear_bit(REG_ID_GIN, out_buffer[4]);
+	}
+
+	restore_interrupts(irq_state);
+
+	interrupt_sync();
+}
+
+static void read_touch_wide(uint8_t reg, uint8_t *out_buffer)
+{
+	(void)reg;
+
+	// both axes from the same instant, then start over
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	out_buffer[0] = (uint8_t)(self.touch_x & 0xFF);
+	out_buffer[1] = (uint8_t)((self.touch_x >> 8) & 0xFF);
+	out_buffer[2] = (uint8_t)(self.touch_y & 0xFF);
+	out_buffer[3] = (uint8_t)((self.touch_y >> 8) & 0xFF);
+	out_buffer[4] = self.touch_overflow ? TXY_OVERFLOW : 0;
+
+	self.touch_x = 0;
+	self.touch_y = 0;
+	self.touch_overflow = false;
+
+	restore_interrupts(irq_state);
+}
+
+static void write_value(uint8_t reg, uint8_t value)
+{
+	reg_set_value(reg, value);
+}
+
+static void write_status(uint8_t reg, uint8_t value)
+{
+	reg_set_value(reg, value);
+	interrupt_sync();
+}
+
+static void write_backlight(uint8_t reg, uint8_t value)
+{
+	reg_set_value(reg, value);
+	backlight_sync();
+}
+
+// a fixed poll rate, as before there was a governor
+static void write_frequency(uint8_t reg, uint8_t value)
+{
+	reg_set_value(reg, value);
+	reg_set_value(REG_ID_SMN, MIN(value * 10, UINT8_MAX));
+	reg_set_value(REG_ID_SMX, MIN(value * 10, UINT8_MAX));
+}
+
+static void write_reset(uint8_t reg, uint8_t value)
+{
+	(void)reg;
+	(void)value;
+
+	NVIC_SystemReset();
+}
+
+static void write_gpio_dir(uint8_t reg, uint8_t value)
+{
+	(void)reg;
+
+	gpioexp_update_dir(value);
+}
+
+static void write_gpio_pull(uint8_t reg, uint8_t value)
+{
+	if (reg == REG_ID_PUE)
+		gpioexp_update_pue_pud(value, reg_get_value(REG_ID_PUD));
+	else
+		gpioexp_update_pue_pud(reg_get_value(REG_ID_PUE), value);
+}
+
+static void write_gpio(uint8_t reg, uint8_t value)
+{
+	(void)reg;
+
+	gpioexp_set_value(value);
+}
+
+static void write_address(uint8_t reg, uint8_t value)
+{
+	reg_set_value(reg, value);
+	puppet_i2c_sync_address();
+}
+
+static void write_config2(uint8_t reg, uint8_t value)
+{
+	reg_set_value(reg, value);
+	interrupt_sync();
+}
+
+static void write_led(uint8_t reg, uint8_t value)
+{
+	reg_set_value(reg, value);
+	led_sync();
+}
+
+static void write_rtc_commit(uint8_t reg, uint8_t value)
+{
+	(void)reg;
+	(void)value;
+
+	rtc_set(reg_get_value(REG_ID_RTC_YEAR), reg_get_value(REG_ID_RTC_MON),
+		reg_get_value(REG_ID_RTC_MDAY), reg_get_value(REG_ID_RTC_HOUR),
+		reg_get_value(REG_ID_RTC_MIN), reg_get_value(REG_ID_RTC_SEC));
+}
+
+// out of range writes are ignored
+static void write_i2c_speed(uint8_t reg, uint8_t value)
+{
+	if ((value < I2C_SPEED_MIN) || (value > I2C_SPEED_MAX))
+		return;
+
+	reg_set_value(reg, value);
+
+	if (reg == REG_ID_PBR)
+		puppet_i2c_sync_baudrate();
+	else
+		touchpad_sync_baudrate();
+}
+
+#define read_none			NULL
+#define write_none			NULL
+
+#define ACCESS_R			(1 << 0)
+#define ACCESS_W			(1 << 1)
+#define ACCESS_RW			(ACCESS_R | ACCESS_W)
+#define ACCESS_ACT			(1 << 2)
+
+#define CLEAR_ON_READ		(1 << 0)
+#define STREAMING			(1 << 1)
+#define SIDE_EFFECTS		(1 << 2)
+
+static const struct
+{
+	uint8_t width;
+	uint8_t access;
+	uint8_t flags;
+	void (*read)(uint8_t reg, uint8_t *out_buffer);
+	void (*write)(uint8_t reg, uint8_t value);
+} reg_map[REG_ID_LAST] = {
+#define X(name, addr, width, access, flags, read, write, desc) \
+	[addr] = { width, ACCESS_##access, flags, read_##read, write_##write },
+	REG_MAP(X)
+#undef X
+};
+
+#define X(name, addr, width, ...) \
+	static_assert(width <= PACKET_OUT_MAX, "REG_ID_" #name " does not fit PACKET_OUT_MAX");
+REG_MAP(X)
+#undef X
+
+static void process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, uint8_t *out_len)
 {
 	const bool is_write = (in_reg & PACKET_WRITE_MASK);
 	const uint8_t reg = (in_reg & ~PACKET_WRITE_MASK);
-	uint16_t adc_value;
 
 //	printf("read complete, is_write: %d, reg: 0x%02X\r\n", is_write, reg);
 
 	*out_len = 0;
 
-	switch (reg) {
-
-	// common R/W registers
-	case REG_ID_CFG:
-	case REG_ID_INT:
-	case REG_ID_DEB:
-	case REG_ID_FRQ:
-	case REG_ID_BKL:
-	case REG_ID_BK2:
-	case REG_ID_GIC:
-	case REG_ID_GIN:
-	case REG_ID_HLD:
-	case REG_ID_ADR:
-	case REG_ID_IND:
-	case REG_ID_CF2:
-	case REG_ID_REWAKE_TIME:
-	case REG_ID_DRIVER_STATE:
-	{
-		if (is_write) {
-			reg_set_value(reg, in_data);
-
-			switch (reg) {
-			case REG_ID_BKL:
-			case REG_ID_BK2:
-				backlight_sync();
-				break;
-
-			case REG_ID_ADR:
-				puppet_i2c_sync_address();
-				break;
-
-			default:
-				break;
-			}
-		} else {
-			out_buffer[0] = reg_get_value(reg);
-			*out_len = sizeof(uint8_t);
-		}
-		break;
-	}
+	if (reg >= REG_ID_LAST)
+		return;
 
-	// special R/W registers
-	case REG_ID_DIR: // gpio direction
-	case REG_ID_PUE: // gpio input pull enable
-	case REG_ID_PUD: // gpio input pull direction
-	{
-		if (is_write) {
-			switch (reg) {
-			case REG_ID_DIR:
-				gpioexp_update_dir(in_data);
-				break;
-			case REG_ID_PUE:
-				gpioexp_update_pue_pud(in_data, reg_get_value(REG_ID_PUD));
-				break;
-			case REG_ID_PUD:
-				gpioexp_update_pue_pud(reg_get_value(REG_ID_PUE), in_data);
-				break;
-			}
-		} else {
-			out_buffer[0] = reg_get_value(reg);
-			*out_len = sizeof(uint8_t);
-		}
-		break;
-	}
+	const uint8_t access = reg_map[reg].access;
 
-	case REG_ID_GIO: // gpio value
-	{
-		if (is_write) {
-			gpioexp_set_value(in_data);
-		} else {
-			out_buffer[0] = gpioexp_get_value();
-			*out_len = sizeof(uint8_t);
-		}
-		break;
-	}
+	if ((access & ACCESS_ACT) || (is_write && (access & ACCESS_W))) {
+		if (reg_map[reg].write)
+			reg_map[reg].write(reg, in_data);
 
-	// RGB LED registers
-	case REG_ID_LED_R:
-	case REG_ID_LED_G:
-	case REG_ID_LED_B:
-	{
-		if (is_write) {
-			reg_set_value(reg, in_data);
-			led_sync();
-		} else {
-			out_buffer[0] = reg_get_value(reg);
-			*out_len = sizeof(uint8_t);
-		}
-		break;
+		return;
 	}
 
-	case REG_ID_LED: // gpio value
-	{
-		if (is_write) {
-			reg_set_value(reg, in_data);
-			led_sync();
-		} else {
-			out_buffer[0] = reg_get_value(reg);
-			*out_len = sizeof(uint8_t);
-		}
-		break;
-	}
+	if (is_write || !(access & ACCESS_R))
+		return;
 
-	// Reawake timer
-	case REG_ID_REWAKE:
-	{
-		break;
-	}
+	if (reg_map[reg].flags & CLEAR_ON_READ) {
+		const uint32_t irq_state = save_and_disable_interrupts();
 
-	// Real time clock
-	case REG_ID_RTC_SEC:
-	case REG_ID_RTC_MIN:
-	case REG_ID_RTC_HOUR:
-	case REG_ID_RTC_MDAY:
-	case REG_ID_RTC_MON:
-	case REG_ID_RTC_YEAR:
-	{
-		if (is_write) {
-			reg_set_value(reg, in_data);
-		} else {
-			out_buffer[0] = rtc_get(reg);
-			*out_len = sizeof(uint8_t);
-		}
-		break;
+		reg_map[reg].read(reg, out_buffer);
+		reg_set_value(reg, 0);
+
+		restore_interrupts(irq_state);
+	} else {
+		reg_map[reg].read(reg, out_buffer);
 	}
 
-	case REG_ID_RTC_COMMIT:
-	{
-		rtc_set(reg_get_value(REG_ID_RTC_YEAR), reg_get_value(REG_ID_RTC_MON),
-			reg_get_value(REG_ID_RTC_MDAY), reg_get_value(REG_ID_RTC_HOUR),
-			reg_get_value(REG_ID_RTC_MIN), reg_get_value(REG_ID_RTC_SEC));
-		break;
+	*out_len = reg_map[reg].width;
+}
+
+static bool dequeue_write(uint8_t *reg, uint8_t *data)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	const bool available = (self.writes_tail != self.writes_head);
+	if (available) {
+		*reg = self.writes[self.writes_tail & WRITE_QUEUE_MASK].reg;
+		*data = self.writes[self.writes_tail & WRITE_QUEUE_MASK].data;
+		self.writes_tail++;
 	}
 
-	// read-only registers
-	case REG_ID_TOX:
-	case REG_ID_TOY:
-		out_buffer[0] = reg_get_value(reg);
-		*out_len = sizeof(uint8_t);
+	restore_interrupts(irq_state);
 
-		reg_set_value(reg, 0);
-		break;
-
-	case REG_ID_VER:
-		out_buffer[0] = VER_VAL;
-		*out_len = sizeof(uint8_t);
-		break;
-
-	case REG_ID_ADC:
-		adc_value = adc_read();
-		out_buffer[0] = (uint8_t)(adc_value & 0x00FF);
-		out_buffer[1] = (uint8_t)((adc_value & 0xFF00) >> 8);
-		*out_len = sizeof(uint8_t) * 2;
-		break;		
-
-	case REG_ID_KEY:
-		out_buffer[0] = fifo_count();
-		*out_len = sizeof(uint8_t);
-		break;
-
-	case REG_ID_FIF:
-	{
-		struct fifo_item item = fifo_dequeue();
+	return available;
+}
+
+static void process_writes(void)
+{
+	uint8_t reg, data, out_buffer[PACKET_OUT_MAX], out_len;
+
+	while (dequeue_write(&reg, &data))
+		process_packet(reg, data, out_buffer, &out_len);
+}
 
-		out_buffer[0] = ((uint8_t*)&item)[0];
-		out_buffer[1] = ((uint8_t*)&item)[1];
-		*out_len = sizeof(uint8_t) * 2;
-		break;
+// The worker drains the queue between two bytes on the bus, it only fills up when the worker is starved.
+// The write is dropped then, running it here would run it out of order, and in the bus IRQ.
+static void enqueue_write(uint8_t reg, uint8_t data)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	if ((self.writes_head - self.writes_tail) < WRITE_QUEUE_SIZE) {
+		self.writes[self.writes_head & WRITE_QUEUE_MASK].reg = reg;
+		self.writes[self.writes_head & WRITE_QUEUE_MASK].data = data;
+		self.writes_head++;
+	} else {
+		reg_set_bit(REG_ID_ERR, ERR_WRITE_DROPPED);
 	}
 
-	case REG_ID_RST:
-		NVIC_SystemReset();
-		break;
+	restore_interrupts(irq_state);
+
+	irq_set_pending(REG_WORKER_IRQ);
+}
+
+// Runs at the lowest priority and applies the queued writes
+static void worker_irq(void)
+{
+	process_writes();
+}
+
+// Called from the bus IRQs, so only reads of the register file happen right away.
+// Writes, and reads that act on the hardware, are deferred to the worker.
+void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, uint8_t *out_len)
+{
+	const uint8_t reg = (in_reg & ~PACKET_WRITE_MASK);
+
+	if ((in_reg & PACKET_WRITE_MASK) || ((reg < REG_ID_LAST) && (reg_map[reg].access & ACCESS_ACT))) {
+		enqueue_write(in_reg, in_data);
+		*out_len = 0;
+		return;
 	}
+
+	process_packet(in_reg, in_data, out_buffer, out_len);
+}
+
+// Streaming registers produce a new reply for every read, until they run out and reply with zeroes
+bool reg_is_streaming(uint8_t reg)
+{
+	return (reg < REG_ID_LAST) && (reg_map[reg].flags & STREAMING);
+}
+
+// Registers that a multi-byte read or write may walk into, the ones with side effects have to be accessed on their own
+bool reg_is_sequential(uint8_t reg)
+{
+	return (reg < REG_ID_LAST) && !(reg_map[reg].flags & SIDE_EFFECTS);
+}
+
+// Applies the deferred writes right away, for callers that need to read back what they wrote.
+// Only call it at the worker's priority, preempting the worker would apply writes out of order.
+void reg_apply_writes(void)
+{
+	process_writes();
 }
 
 uint8_t reg_get_value(enum reg_id reg)
@@ -261,7 +494,7 @@ void reg_init(void)
 {
 	reg_set_value(REG_ID_CFG, CFG_OVERFLOW_INT | CFG_KEY_INT | CFG_USE_MODS);
 	reg_set_value(REG_ID_BKL, 255);
-	reg_set_value(REG_ID_DEB, 10);
+	reg_set_value(REG_ID_DEB, DEB_EAGER | 10);	// ms
 	reg_set_value(REG_ID_FRQ, 10);	// ms
 	reg_set_value(REG_ID_BK2, 255);
 	reg_set_value(REG_ID_PUD, 0xFF);
@@ -270,6 +503,20 @@ void reg_init(void)
 	reg_set_value(REG_ID_IND, 1);	// ms
 	reg_set_value(REG_ID_CF2, CF2_TOUCH_INT | CF2_USB_KEYB_ON | CF2_USB_MOUSE_ON);
 	reg_set_value(REG_ID_DRIVER_STATE, 0); // Driver not yet loaded
+	reg_set_value(REG_ID_IDL, 50);	// 10ms units
+	reg_set_value(REG_ID_SMN, 10);	// 100us units
+	reg_set_value(REG_ID_SMX, 100);	// 100us units
+	reg_set_value(REG_ID_PBR, PUPPET_I2C_BAUDRATE / I2C_SPEED_UNIT);
+	reg_set_value(REG_ID_TBR, TP_I2C_BAUDRATE / I2C_SPEED_UNIT);
 
 	touchpad_add_touch_callback(&touch_callback);
+
+	// a host may read REG_ID_ADC as soon as the bus is up
+	adc_init();
+	adc_gpio_init(PIN_BAT_ADC);
+	adc_select_input(0);
+
+	irq_set_exclusive_handler(REG_WORKER_IRQ, worker_irq);
+	irq_set_priority(REG_WORKER_IRQ, PICO_LOWEST_IRQ_PRIORITY);
+	irq_set_enabled(REG_WORKER_IRQ, true);
 }
@@ -3,49 +3,13 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "reg_map.h"
+
 enum reg_id
 {
-	REG_ID_VER = 0x01, // fw version
-	REG_ID_CFG = 0x02, // config
-	REG_ID_INT = 0x03, // interrupt status
-	REG_ID_KEY = 0x04, // key status
-	REG_ID_BKL = 0x05, // backlight
-	REG_ID_DEB = 0x06, // key debounce cfg (not implemented)
-	REG_ID_FRQ = 0x07, // key poll freq cfg
-	REG_ID_RST = 0x08, // trigger a reset
-	REG_ID_FIF = 0x09, // key fifo
-	REG_ID_BK2 = 0x0A, // backlight 2
-	REG_ID_DIR = 0x0B, // gpio direction
-	REG_ID_PUE = 0x0C, // gpio input pull enable
-	REG_ID_PUD = 0x0D, // gpio input pull direction
-	REG_ID_GIO = 0x0E, // gpio value
-	REG_ID_GIC = 0x0F, // gpio interrupt config
-	REG_ID_GIN = 0x10, // gpio interrupt status
-	REG_ID_HLD = 0x11, // key hold time cfg (in 10ms units)
-	REG_ID_ADR = 0x12, // i2c puppet address
-	REG_ID_IND = 0x13, // interrupt pin assert duration
-	REG_ID_CF2 = 0x14, // config 2
-	REG_ID_TOX = 0x15, // touch delta x since last read, at most (-128 to 127)
-	REG_ID_TOY = 0x16, // touch delta y since last read, at most (-128 to 127)
-
-	REG_ID_ADC = 0x17,
-	REG_ID_LED    = 0x20,
-	REG_ID_LED_R  = 0x21,
-	REG_ID_LED_G  = 0x22,
-	REG_ID_LED_B  = 0x23,
-
-	REG_ID_REWAKE_TIME = 0x24, // Power on the Pi in this many minutes
-	REG_ID_REWAKE = 0x25, // Write to shut off Pi, power on after REWAKE_TIME
-
-	REG_ID_RTC_SEC = 0x26,
-	REG_ID_RTC_MIN = 0x27,
-	REG_ID_RTC_HOUR = 0x28,
-	REG_ID_RTC_MDAY = 0x29,
-	REG_ID_RTC_MON = 0x2A,
-	REG_ID_RTC_YEAR = 0x2B, // Years since 1900
-	REG_ID_RTC_COMMIT = 0x2C,
-
-	REG_ID_DRIVER_STATE = 0x2D, // Set when driver is loaded / unloaded cleanly
+#define X(name, addr, ...) REG_ID_##name = addr,
+	REG_MAP(X)
+#undef X
 
 	REG_ID_LAST,
 };
@@ -62,8 +26,13 @@ enum reg_id
 #define CF2_TOUCH_INT		(1 << 0) // Should touch events generate interrupts
 #define CF2_USB_KEYB_ON		(1 << 1) // Should key events be sent over USB HID
 #define CF2_USB_MOUSE_ON	(1 << 2) // Should touch events be sent over USB HID
+#define CF2_SNAPSHOT_CLR	(1 << 3) // Should reading REG_ID_SNP clear the INT and GIN bits it returned
+#define CF2_INT_LEVEL		(1 << 4) // Should INT stay asserted while an interrupt is pending, reads clear what they return
 // TODO? CF2_STICKY_MODS // Pressing and releasing a mod affects next key pressed
 
+#define DEB_EAGER			(1 << 7) // Report the first edge right away and ignore the bounces after it
+#define DEB_TIME_MASK		0x7F     // Debounce time in ms
+
 #define INT_OVERFLOW		(1 << 0)
 #define INT_CAPSLOCK		(1 << 1)
 #define INT_NUMLOCK			(1 << 2)
@@ -73,6 +42,19 @@ enum reg_id
 #define INT_TOUCH			(1 << 6)
 // Future me: If we need more INT_*, add a INT2 and use (1 << 7) here as indicator that the info is in INT2
 
+#define TXY_OVERFLOW		(1 << 0) // A delta did not fit in 16 bits and was clamped
+
+#define ERR_WRITE_DROPPED	(1 << 0) // A write came in while the write queue was full and was ignored
+
+#define EVS_KEY				(1 << 0) // Should key events be pushed on the USB event stream
+#define EVS_TOUCH			(1 << 1) // Should touch events be pushed on the USB event stream
+#define EVS_GPIO			(1 << 2) // Should GPIO interrupts be pushed on the USB event stream
+
+#define EVT_RECORD_LEN		6    // Event stream record: type, sequence number, then 4 bytes of data
+#define EVT_KEY				0x01 // Data: key, state
+#define EVT_TOUCH			0x02 // Data: x and y deltas, 16-bit little-endian each
+#define EVT_GPIO			0x03 // Data: GPIO index, pin value
+
 #define KEY_CAPSLOCK		(1 << 5) // Caps lock status
 #define KEY_NUMLOCK			(1 << 6) // Num lock status
 #define KEY_COUNT_MASK		0x1F
@@ -85,9 +67,18 @@ enum reg_id
 
 #define VER_VAL				((VERSION_MAJOR << 4) | (VERSION_MINOR << 0))
 
+#define I2C_SPEED_UNIT		(10 * 1000)
+#define I2C_SPEED_MIN		10  // standard mode, 100kHz
+#define I2C_SPEED_MAX		100 // fast mode plus, 1MHz
+
 #define PACKET_WRITE_MASK	(1 << 7)
+#define PACKET_OUT_MAX		6 // longest reply to a single register read
+#define PACKET_BATCH_MARKER	0x00 // first byte of a batch of accesses over USB, there is no register 0
 
 void reg_process_packet(uint8_t in_reg, uint8_t in_data, uint8_t *out_buffer, uint8_t *out_len);
+bool reg_is_streaming(uint8_t reg);
+bool reg_is_sequential(uint8_t reg);
+void reg_apply_writes(void);
 
 uint8_t reg_get_value(enum reg_id reg);
 void reg_set_value(enum reg_id reg, uint8_t value);
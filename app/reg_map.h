@@ -0,0 +1,64 @@
+#pragma once
+
+// The register map, the single source for the firmware dispatch table in reg.c,
+// the reg_id enum in reg.h and the host side constants generated by etc/gen_regs.py.
+//
+// X(name, address, reply width, access, flags, read hook, write hook, description)
+//
+// access: R, W, RW, or ACT for registers where any access triggers the write hook
+// flags: CLEAR_ON_READ, STREAMING, SIDE_EFFECTS (never walked into by block accesses)
+// hooks: value reads or writes the register file, none does nothing
+
+#define REG_MAP(X) \
+	X(VER,          0x01, 1, R,   0,                        version,    none,        "fw version") \
+	X(CFG,          0x02, 1, RW,  0,                        value,      value,       "config") \
+	X(INT,          0x03, 1, RW,  0,                        status,     status,      "interrupt status") \
+	X(KEY,          0x04, 1, R,   0,                        key_status, none,        "key status") \
+	X(BKL,          0x05, 1, RW,  0,                        value,      backlight,   "backlight") \
+	X(DEB,          0x06, 1, RW,  0,                        value,      value,       "key debounce cfg") \
+	X(FRQ,          0x07, 1, RW,  0,                        value,      frequency,   "key poll freq cfg, sets both SMN and SMX") \
+	X(RST,          0x08, 0, ACT, SIDE_EFFECTS,             none,       reset,       "trigger a reset") \
+	X(FIF,          0x09, 2, R,   SIDE_EFFECTS,             fifo,       none,        "key fifo") \
+	X(BK2,          0x0A, 1, RW,  0,                        value,      backlight,   "backlight 2") \
+	X(DIR,          0x0B, 1, RW,  0,                        value,      gpio_dir,    "gpio direction") \
+	X(PUE,          0x0C, 1, RW,  0,                        value,      gpio_pull,   "gpio input pull enable") \
+	X(PUD,          0x0D, 1, RW,  0,                        value,      gpio_pull,   "gpio input pull direction") \
+	X(GIO,          0x0E, 1, RW,  0,                        gpio,       gpio,        "gpio value") \
+	X(GIC,          0x0F, 1, RW,  0,                        value,      value,       "gpio interrupt config") \
+	X(GIN,          0x10, 1, RW,  0,                        status,     status,      "gpio interrupt status") \
+	X(HLD,          0x11, 1, RW,  0,                        value,      value,       "key hold time cfg (in 10ms units)") \
+	X(ADR,          0x12, 1, RW,  0,                        value,      address,     "i2c puppet address") \
+	X(IND,          0x13, 1, RW,  0,                        value,      value,       "interrupt pin assert duration") \
+	X(CF2,          0x14, 1, RW,  0,                        value,      config2,     "config 2") \
+	X(TOX,          0x15, 1, R,   CLEAR_ON_READ,            value,      none,        "touch delta x since last read, at most (-128 to 127)") \
+	X(TOY,          0x16, 1, R,   CLEAR_ON_READ,            value,      none,        "touch delta y since last read, at most (-128 to 127)") \
+	X(ADC,          0x17, 2, R,   0,                        adc,        none,        "battery voltage, raw 12-bit ADC value") \
+	X(LED,          0x20, 1, RW,  0,                        value,      led,         "LED on/off") \
+	X(LED_R,        0x21, 1, RW,  0,                        value,      led,         "LED red value") \
+	X(LED_G,        0x22, 1, RW,  0,                        value,      led,         "LED green value") \
+	X(LED_B,        0x23, 1, RW,  0,                        value,      led,         "LED blue value") \
+	X(REWAKE_TIME,  0x24, 1, RW,  0,                        value,      value,       "power on the Pi in this many minutes") \
+	X(REWAKE,       0x25, 0, W,   SIDE_EFFECTS,             none,       none,        "write to shut off Pi, power on after REWAKE_TIME") \
+	X(RTC_SEC,      0x26, 1, RW,  0,                        rtc,        value,       "rtc seconds") \
+	X(RTC_MIN,      0x27, 1, RW,  0,                        rtc,        value,       "rtc minutes") \
+	X(RTC_HOUR,     0x28, 1, RW,  0,                        rtc,        value,       "rtc hours") \
+	X(RTC_MDAY,     0x29, 1, RW,  0,                        rtc,        value,       "rtc day of the month") \
+	X(RTC_MON,      0x2A, 1, RW,  0,                        rtc,        value,       "rtc month") \
+	X(RTC_YEAR,     0x2B, 1, RW,  0,                        rtc,        value,       "rtc years since 1900") \
+	X(RTC_COMMIT,   0x2C, 0, ACT, SIDE_EFFECTS,             none,       rtc_commit,  "set the rtc to the RTC_* values") \
+	X(DRIVER_STATE, 0x2D, 1, RW,  0,                        value,      value,       "set when driver is loaded / unloaded cleanly") \
+	X(IDL,          0x2E, 1, RW,  0,                        value,      value,       "key scan idle timeout (in 10ms units, 0 to always scan)") \
+	X(SMN,          0x2F, 1, RW,  0,                        value,      value,       "fastest key scan interval (in 100us units)") \
+	X(SMX,          0x30, 1, RW,  0,                        value,      value,       "slowest key scan interval (in 100us units)") \
+	X(SCI,          0x31, 1, R,   0,                        value,      none,        "current key scan interval (in 100us units)") \
+	X(FTS,          0x32, 6, R,   SIDE_EFFECTS,             fifo_time,  none,        "key fifo with timestamps") \
+	X(FBR,          0x33, 2, R,   SIDE_EFFECTS | STREAMING, fifo,       none,        "key fifo burst, every read request pops the next entry") \
+	X(SNP,          0x34, 5, R,   SIDE_EFFECTS,             snapshot,   none,        "status snapshot: INT, KEY, TOX, TOY and GIN in one read") \
+	X(IGP,          0x35, 1, RW,  0,                        value,      value,       "minimum gap between two interrupts (in ms)") \
+	X(IDY,          0x36, 1, RW,  0,                        value,      value,       "longest an event may wait for its interrupt (in ms)") \
+	X(ICT,          0x37, 1, RW,  0,                        value,      value,       "pending events that trigger an interrupt right away (0 to disable)") \
+	X(PBR,          0x38, 1, RW,  0,                        value,      i2c_speed,   "i2c puppet bus speed (in 10kHz units)") \
+	X(TBR,          0x39, 1, RW,  0,                        value,      i2c_speed,   "touchpad i2c bus speed (in 10kHz units)") \
+	X(TXY,          0x3A, 5, R,   SIDE_EFFECTS,             touch_wide, none,        "touch delta x and y since last read, 16-bit each, and TXY_* flags") \
+	X(EVS,          0x3B, 1, RW,  0,                        value,      value,       "usb event stream subscription, EVS_* bits") \
+	X(ERR,          0x3C, 1, R,   CLEAR_ON_READ,            value,      none,        "errors since last read, ERR_* bits")
@@ -5,6 +5,15 @@
 #include <pico/util/datetime.h>
 #include <RP2040.h>
 #include <hardware/rtc.h>
+#include <hardware/sync.h>
+
+static struct
+{
+	// the time last set, and when, rtc_get() moves it on by the time since
+	datetime_t set_time;
+	uint64_t set_time_us;
+	bool running;
+} self;
 
 // https://electronics.stackexchange.com/questions/66285/how-to-calculate-day-of-the-week-for-rtc
 static int leap(int year)
@@ -22,6 +31,29 @@ static int dow(int year, int month, int day)
 	return (zeller (year, month, day) % 7);
 }
 
+// https://howardhinnant.github.io/date_algorithms.html
+static int32_t days_from_civil(int32_t year, int32_t month, int32_t day)
+{
+	year -= (month <= 2);
+	const int32_t era = (year >= 0 ? year : year - 399) / 400;
+	const int32_t yoe = year - era * 400;
+	const int32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	const int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+static void civil_from_days(int32_t days, datetime_t *t)
+{
+	days += 719468;
+	const int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+	const int32_t doe = days - era * 146097;
+	const int32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const int32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const int32_t mp = (5 * doy + 2) / 153;
+	t->day = doy - (153 * mp + 2) / 5 + 1;
+	t->month = mp < 10 ? mp + 3 : mp - 9;
+	t->year = yoe + era * 400 + (t->month <= 2);
+}
+
 void rtc_set(uint8_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
 {
 	datetime_t t;
@@ -33,14 +65,39 @@ void rtc_set(uint8_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t min
 	t.sec = sec;
 	t.dotw = dow(t.year, month, day);
 
-	rtc_set_datetime(&t);
+	// an invalid date is rejected and leaves the RTC as it was
+	if (!rtc_set_datetime(&t))
+		return;
+
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	self.set_time = t;
+	self.set_time_us = time_us_64();
+	self.running = true;
+
+	restore_interrupts(irq_state);
 }
 
+// Worked out from the last rtc_set() instead of reading the hardware, that takes too long for the bus IRQ.
+// The RTC and the system timer run off the same crystal, so the two don't drift apart.
 uint8_t rtc_get(enum reg_id reg)
 {
-	datetime_t t;
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	datetime_t t = self.set_time;
+	const uint64_t set_time_us = self.set_time_us;
+	const bool running = self.running;
 
-	rtc_get_datetime(&t);
+	restore_interrupts(irq_state);
+
+	if (running) {
+		const uint32_t secs = t.sec + t.min * 60 + t.hour * 3600 + (uint32_t)((time_us_64() - set_time_us) / 1000000);
+
+		civil_from_days(days_from_civil(t.year, t.month, t.day) + secs / 86400, &t);
+		t.hour = (secs / 3600) % 24;
+		t.min = (secs / 60) % 60;
+		t.sec = secs % 60;
+	}
 
 	switch (reg) {
 		case REG_ID_RTC_SEC: return (uint8_t)t.sec;
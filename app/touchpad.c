@@ -1,8 +1,12 @@
 #include "touchpad.h"
 
 #include "keyboard.h"
+#include "reg.h"
 
+#include <hardware/dma.h>
 #include <hardware/i2c.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
 #include <pico/binary_info.h>
 #include <pico/stdlib.h>
 #include <stdio.h>
@@ -29,6 +33,12 @@
 #define BIT_OBSERV_REST2	(2 << 6)
 #define BIT_OBSERV_REST3	(3 << 6)
 
+static_assert((TP_I2C_BAUDRATE >= I2C_SPEED_MIN * I2C_SPEED_UNIT) && (TP_I2C_BAUDRATE <= I2C_SPEED_MAX * I2C_SPEED_UNIT),
+	"TP_I2C_BAUDRATE is out of range");
+
+// the touchpad owns the IRQ of its I2C instance
+static_assert(((PIN_SCL / 2) % 2) != ((PIN_PUPPET_SCL / 2) % 2), "the touchpad and the puppet must be on different I2C instances");
+
 #define SWIPE_COOLDOWN_TIME_MS	100 // time to wait before generating a new swipe event
 #define SWIPE_RELEASE_DELAY_MS	10  // time to wait before sending key release event
 #define MOTION_IS_SWIPE(i, j)	(((i >= 15) || (i <= -15)) && ((j >= -5) && (j <= 5)))
@@ -40,16 +50,23 @@ static struct
 	struct touch_callback *callbacks;
 	uint32_t last_swipe_time;
 	i2c_inst_t *i2c;
+
+	// the motion burst read runs on DMA, the motion IRQ only starts it
+	uint dma_tx;
+	uint dma_rx;
+	uint32_t burst_cmds[5];
+	uint8_t burst[4];
+	bool busy;
+	bool motion_pending;
+	bool baudrate_changed;
 } self;
 
-static uint8_t read_register8(uint8_t reg)
+// the deltas are 12-bit two's complement, split into a low byte and a nibble of REG_DELTA_XY_H
+static int16_t delta12(uint8_t low, uint8_t high)
 {
-	uint8_t val;
-
-	i2c_write_blocking(self.i2c, DEV_ADDR, &reg, sizeof(reg), true);
-	i2c_read_blocking(self.i2c, DEV_ADDR, &val, sizeof(val), false);
+	const int16_t value = ((high & 0x0F) << 8) | low;
 
-	return val;
+	return (value & 0x800) ? (value - 0x1000) : value;
 }
 
 //static void write_register8(uint8_t reg, uint8_t val)
@@ -69,21 +86,12 @@ int64_t release_key(alarm_id_t id, void *user_data)
 	return 0;
 }
 
-void touchpad_gpio_irq(uint gpio, uint32_t events)
+static void handle_motion(const uint8_t *burst)
 {
-	if (gpio != PIN_TP_MOTION)
-		return;
-
-	if (!(events & GPIO_IRQ_EDGE_FALL))
-		return;
-
-	const uint8_t motion = read_register8(REG_MOTION);
+	const uint8_t motion = burst[0];
 	if (motion & BIT_MOTION_MOT) {
-		int8_t x = read_register8(REG_DELTA_X);
-		int8_t y = read_register8(REG_DELTA_Y);
-
-		x = ((x < 127) ? x : (x - 256)) * -1;
-		y = ((y < 127) ? y : (y - 256));
+		const int16_t x = delta12(burst[1], burst[3] >> 4) * -1;
+		const int16_t y = delta12(burst[2], burst[3]);
 
 		if (self.callbacks) {
 			struct touch_callback *cb = self.callbacks;
@@ -97,6 +105,78 @@ void touchpad_gpio_irq(uint gpio, uint32_t events)
 	}
 }
 
+// motion, delta x, delta y and the high bits of both deltas, in one transaction
+static void start_motion_read(void)
+{
+	self.busy = true;
+
+	dma_channel_transfer_to_buffer_now(self.dma_rx, self.burst, sizeof(self.burst));
+	dma_channel_transfer_from_buffer_now(self.dma_tx, self.burst_cmds, count_of(self.burst_cmds));
+}
+
+static void motion_read_done(bool ok)
+{
+	self.busy = false;
+
+	if (ok)
+		handle_motion(self.burst);
+
+	// the speed can only change while the bus is idle
+	if (self.baudrate_changed) {
+		i2c_set_baudrate(self.i2c, reg_get_value(REG_ID_TBR) * I2C_SPEED_UNIT);
+		self.baudrate_changed = false;
+	}
+
+	if (self.motion_pending) {
+		self.motion_pending = false;
+		start_motion_read();
+	}
+}
+
+static void dma_irq_handler(void)
+{
+	if (!(dma_hw->ints1 & (1u << self.dma_rx)))
+		return;
+
+	dma_hw->ints1 = (1u << self.dma_rx);
+
+	motion_read_done(true);
+}
+
+// the sensor didn't ack, the RX channel will never finish on its own
+static void i2c_irq_handler(void)
+{
+	if (!(self.i2c->hw->intr_stat & I2C_IC_INTR_STAT_R_TX_ABRT_BITS))
+		return;
+
+	self.i2c->hw->clr_tx_abrt;
+
+	// aborting can raise the channel's IRQ, see RP2040-E13
+	dma_channel_set_irq1_enabled(self.dma_rx, false);
+	dma_channel_abort(self.dma_tx);
+	dma_channel_abort(self.dma_rx);
+	dma_hw->ints1 = (1u << self.dma_rx);
+	dma_channel_set_irq1_enabled(self.dma_rx, true);
+
+	motion_read_done(false);
+}
+
+void touchpad_gpio_irq(uint gpio, uint32_t events)
+{
+	if (gpio != PIN_TP_MOTION)
+		return;
+
+	if (!(events & GPIO_IRQ_EDGE_FALL))
+		return;
+
+	if (self.busy) {
+		self.motion_pending = true;
+		return;
+	}
+
+	start_motion_read();
+}
+
 void touchpad_add_touch_callback(struct touch_callback *callback)
 {
 	// first callback
@@ -113,12 +193,25 @@ void touchpad_add_touch_callback(struct touch_callback *callback)
 	cb->next = callback;
 }
 
+void touchpad_sync_baudrate(void)
+{
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	// changing the speed disables the block, wait for the current read to finish
+	if (self.busy)
+		self.baudrate_changed = true;
+	else
+		i2c_set_baudrate(self.i2c, reg_get_value(REG_ID_TBR) * I2C_SPEED_UNIT);
+
+	restore_interrupts(irq_state);
+}
+
 void touchpad_init(void)
 {
 	// determine the instance based on SCL pin, hope you didn't screw up the SDA pin!
 	self.i2c = i2c_instances[(PIN_SCL / 2) % 2];
 
-	i2c_init(self.i2c, 100 * 1000);
+	i2c_init(self.i2c, reg_get_value(REG_ID_TBR) * I2C_SPEED_UNIT);
 
 	gpio_set_function(PIN_SDA, GPIO_FUNC_I2C);
 	gpio_pull_up(PIN_SDA);
@@ -129,6 +222,46 @@ void touchpad_init(void)
 	// Make the I2C pins available to picotool
 	bi_decl(bi_2pins_with_func(PIN_SDA, PIN_SCL, GPIO_FUNC_I2C));
 
+	// the sensor is the only device on the bus
+	self.i2c->hw->enable = 0;
+	self.i2c->hw->tar = DEV_ADDR;
+	self.i2c->hw->enable = 1;
+
+	// write the burst register, then read it back with a restart, a STOP after the last byte
+	self.burst_cmds[0] = REG_MBURST;
+	self.burst_cmds[1] = I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_RESTART_BITS;
+	self.burst_cmds[2] = I2C_IC_DATA_CMD_CMD_BITS;
+	self.burst_cmds[3] = I2C_IC_DATA_CMD_CMD_BITS;
+	self.burst_cmds[4] = I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_STOP_BITS;
+	static_assert(count_of(self.burst_cmds) == count_of(self.burst) + 1, "one command per byte read, plus the register");
+
+	self.dma_tx = dma_claim_unused_channel(true);
+	self.dma_rx = dma_claim_unused_channel(true);
+
+	dma_channel_config config = dma_channel_get_default_config(self.dma_tx);
+	channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+	channel_config_set_read_increment(&config, true);
+	channel_config_set_write_increment(&config, false);
+	channel_config_set_dreq(&config, i2c_get_dreq(self.i2c, true));
+	dma_channel_configure(self.dma_tx, &config, &self.i2c->hw->data_cmd, self.burst_cmds, count_of(self.burst_cmds), false);
+
+	config = dma_channel_get_default_config(self.dma_rx);
+	channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+	channel_config_set_read_increment(&config, false);
+	channel_config_set_write_increment(&config, true);
+	channel_config_set_dreq(&config, i2c_get_dreq(self.i2c, false));
+	dma_channel_configure(self.dma_rx, &config, self.burst, &self.i2c->hw->data_cmd, count_of(self.burst), false);
+
+	dma_channel_set_irq1_enabled(self.dma_rx, true);
+	irq_set_exclusive_handler(DMA_IRQ_1, dma_irq_handler);
+	irq_set_enabled(DMA_IRQ_1, true);
+
+	self.i2c->hw->intr_mask = I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+
+	const int irq = I2C0_IRQ + i2c_hw_index(self.i2c);
+	irq_set_exclusive_handler(irq, i2c_irq_handler);
+	irq_set_enabled(irq, true);
+
 	gpio_init(PIN_TP_SHUTDOWN);
 	gpio_set_dir(PIN_TP_SHUTDOWN, GPIO_OUT);
 	gpio_put(PIN_TP_SHUTDOWN, 0);
@@ -5,7 +5,7 @@
 
 struct touch_callback
 {
-	void (*func)(int8_t, int8_t);
+	void (*func)(int16_t, int16_t);
 	struct touch_callback *next;
 };
 
@@ -13,4 +13,6 @@ void touchpad_gpio_irq(uint gpio, uint32_t events);
 
 void touchpad_add_touch_callback(struct touch_callback *callback);
 
+void touchpad_sync_baudrate(void);
+
 void touchpad_init(void);
@@ -8,6 +8,7 @@ enum
 	USB_ITF_CDC,
 	USB_ITF_CDC2,
 	USB_ITF_VENDOR,
+	USB_ITF_EVENTS,
 	USB_ITF_MAX,
 };
 
@@ -25,9 +26,13 @@ enum
 #define CFG_TUD_CDC					1
 #define CFG_TUD_MSC					0
 #define CFG_TUD_MIDI				0
-#define CFG_TUD_VENDOR				1
+#define CFG_TUD_VENDOR				2
 
-#define CFG_TUD_HID_EP_BUFSIZE		8
+#define CFG_TUD_HID_EP_BUFSIZE		32
+
+// NKRO keyboard report: the modifier byte, then one bit for every usage below the modifiers
+#define USB_KEYB_USAGE_COUNT		0xE0
+#define USB_KEYB_REPORT_LEN			(1 + USB_KEYB_USAGE_COUNT / 8)
 
 #define CFG_TUD_CDC_RX_BUFSIZE		256
 #define CFG_TUD_CDC_TX_BUFSIZE		256
@@ -1,24 +1,61 @@
 #include "usb.h"
 
 #include "backlight.h"
+#include "gpioexp.h"
 #include "keyboard.h"
 #include "touchpad.h"
 #include "reg.h"
 
 #include <hardware/irq.h>
+#include <hardware/sync.h>
 #include <pico/mutex.h>
+#include <pico/stdlib.h>
 #include <tusb.h>
 
 #define USB_LOW_PRIORITY_IRQ	31
-#define USB_TASK_INTERVAL_US	1000
+
+// vendor instances, in the order of their interfaces in the configuration descriptor
+#define USB_VENDOR_REGS			0
+#define USB_VENDOR_EVENTS		1
+
+#define KEYB_QUEUE_SIZE			32
+#define KEYB_QUEUE_MASK			(KEYB_QUEUE_SIZE - 1)
+
+#define EVENT_QUEUE_SIZE		32
+#define EVENT_QUEUE_MASK		(EVENT_QUEUE_SIZE - 1)
+#define EVENTS_PER_PACKET		(CFG_TUD_VENDOR_TX_BUFSIZE / EVT_RECORD_LEN)
 
 static struct
 {
 	mutex_t mutex;
 	bool mouse_moved;
 	uint8_t mouse_btn;
-
-	uint8_t write_buffer[2];
+	uint8_t mouse_sent_btn;
+
+	// touch motion not reported yet
+	int16_t mouse_x;
+	int16_t mouse_y;
+
+	// key changes not sent yet, on top of the keyboard state in report layout.
+	// The base is what the host last got, plus changes that had to make room in a full queue.
+	struct
+	{
+		uint8_t idx;
+		uint8_t mask;
+		bool pressed;
+	} keyb_queue[KEYB_QUEUE_SIZE];
+	uint8_t keyb_head;
+	uint8_t keyb_tail;
+	uint8_t keyb_base[USB_KEYB_REPORT_LEN];
+	uint8_t keyb_sent[USB_KEYB_REPORT_LEN];
+
+	// event stream records not sent yet, the sequence number counts dropped records too
+	uint8_t events[EVENT_QUEUE_SIZE][EVT_RECORD_LEN];
+	uint8_t events_head;
+	uint8_t events_tail;
+	uint8_t event_seq;
+
+	uint8_t write_buffer[PACKET_OUT_MAX];
 	uint8_t write_len;
 } self;
 
@@ -26,69 +63,284 @@ static struct
 // TODO: What should L1, L2, R1, R2 do
 // TODO: Should touch send arrow keys as an option?
 
+// Sends the buttons and the accumulated motion, at most what fits in one report, the rest waits for the next one.
+// The motion is only taken out once the report was accepted, so nothing is lost while the endpoint is busy.
+static void flush_mouse(void)
+{
+	if (!tud_hid_n_ready(USB_ITF_MOUSE))
+		return;
+
+	uint32_t irq_state = save_and_disable_interrupts();
+
+	const int8_t x = MAX(-127, MIN(self.mouse_x, 127));
+	const int8_t y = MAX(-127, MIN(self.mouse_y, 127));
+	const uint8_t btn = self.mouse_btn;
+
+	restore_interrupts(irq_state);
+
+	if (!x && !y && (btn == self.mouse_sent_btn))
+		return;
+
+	if (!tud_hid_n_mouse_report(USB_ITF_MOUSE, 0, btn, x, y, 0, 0))
+		return;
+
+	self.mouse_sent_btn = btn;
+
+	// touch_cb may have added more meanwhile, that stays for the next report
+	irq_state = save_and_disable_interrupts();
+
+	self.mouse_x -= x;
+	self.mouse_y -= y;
+
+	restore_interrupts(irq_state);
+}
+
+// Boot protocol has room for six keys, more than that reports a rollover error
+static void send_keyb_boot_report(const uint8_t *report)
+{
+	uint8_t keycode[6] = { 0 };
+	uint8_t count = 0;
+
+	for (uint8_t key = KEY_A; key < USB_KEYB_USAGE_COUNT; ++key) {
+		if (!(report[1 + key / 8] & (1 << (key % 8))))
+			continue;
+
+		if (count == sizeof(keycode)) {
+			memset(keycode, KEY_ERR_OVF, sizeof(keycode));
+			break;
+		}
+
+		keycode[count++] = key;
+	}
+
+	tud_hid_n_keyboard_report(USB_ITF_KEYBOARD, 0, report[0], keycode);
+}
+
+static void apply_keyb_change(uint8_t *report, uint8_t idx, uint8_t mask, bool pressed)
+{
+	if (pressed)
+		report[idx] |= mask;
+	else
+		report[idx] &= ~mask;
+}
+
+// Sends the queued key changes, as many as fit in one report. A key that changes again before its
+// first change went out waits for the next report, so the host sees every tap.
+static void flush_keyboard(void)
+{
+	if (!tud_hid_n_ready(USB_ITF_KEYBOARD))
+		return;
+
+	uint8_t report[USB_KEYB_REPORT_LEN];
+
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	memcpy(report, self.keyb_base, sizeof(report));
+
+	while (self.keyb_tail != self.keyb_head) {
+		const uint8_t slot = self.keyb_tail & KEYB_QUEUE_MASK;
+		const uint8_t idx = self.keyb_queue[slot].idx;
+		const uint8_t mask = self.keyb_queue[slot].mask;
+
+		if ((report[idx] ^ self.keyb_sent[idx]) & mask)
+			break;
+
+		apply_keyb_change(report, idx, mask, self.keyb_queue[slot].pressed);
+		self.keyb_tail++;
+	}
+
+	const bool changed = (memcmp(report, self.keyb_sent, sizeof(report)) != 0);
+
+	memcpy(self.keyb_base, report, sizeof(report));
+	memcpy(self.keyb_sent, report, sizeof(report));
+
+	restore_interrupts(irq_state);
+
+	if (!changed)
+		return;
+
+	if (tud_hid_n_get_protocol(USB_ITF_KEYBOARD) == HID_PROTOCOL_BOOT)
+		send_keyb_boot_report(report);
+	else
+		tud_hid_n_report(USB_ITF_KEYBOARD, 0, report, sizeof(report));
+}
+
+// Queues an event stream record, when the queue is full the record is dropped and leaves a gap in the sequence
+static void push_event(uint8_t type, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3)
+{
+	if (!tud_mounted())
+		return;
+
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	const uint8_t seq = self.event_seq++;
+
+	if ((uint8_t)(self.events_head - self.events_tail) < EVENT_QUEUE_SIZE) {
+		uint8_t *record = self.events[self.events_head & EVENT_QUEUE_MASK];
+
+		record[0] = type;
+		record[1] = seq;
+		record[2] = d0;
+		record[3] = d1;
+		record[4] = d2;
+		record[5] = d3;
+
+		self.events_head++;
+	}
+
+	restore_interrupts(irq_state);
+
+	usb_schedule_task();
+}
+
+// Sends the queued records once the previous packet is on its way, so the records that come in
+// meanwhile go out together. A packet only holds whole records.
+static void flush_events(void)
+{
+	if (!tud_vendor_n_mounted(USB_VENDOR_EVENTS))
+		return;
+
+	if (tud_vendor_n_write_available(USB_VENDOR_EVENTS) < CFG_TUD_VENDOR_TX_BUFSIZE)
+		return;
+
+	uint8_t packet[EVENTS_PER_PACKET * EVT_RECORD_LEN];
+	uint8_t len = 0;
+
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	while ((self.events_tail != self.events_head) && (len < sizeof(packet))) {
+		memcpy(&packet[len], self.events[self.events_tail & EVENT_QUEUE_MASK], EVT_RECORD_LEN);
+		len += EVT_RECORD_LEN;
+		self.events_tail++;
+	}
+
+	restore_interrupts(irq_state);
+
+	if (len)
+		tud_vendor_n_write(USB_VENDOR_EVENTS, packet, len);
+}
+
 static void low_priority_worker_irq(void)
 {
 	if (mutex_try_enter(&self.mutex, NULL)) {
 		tud_task();
+		flush_keyboard();
+		flush_mouse();
+		flush_events();
 
 		mutex_exit(&self.mutex);
 	}
 }
 
-static int64_t timer_task(alarm_id_t id, void *user_data)
+// runs after the TinyUSB handler, so tud_task() picks up whatever the controller just did
+static void usb_irq(void)
 {
-	(void)id;
-	(void)user_data;
-
 	irq_set_pending(USB_LOW_PRIORITY_IRQ);
+}
+
+// Queues the key change for the keyboard report, the report itself goes out from the USB worker
+static void queue_keyb_change(uint8_t key, enum key_state state)
+{
+	uint8_t idx;
+	uint8_t mask;
+
+	if ((key >= KEY_LEFTCTRL) && (key <= KEY_RIGHTMETA)) {
+		idx = 0;
+		mask = 1 << (key - KEY_LEFTCTRL);
+	} else if ((key > KEY_NONE) && (key < USB_KEYB_USAGE_COUNT)) {
+		idx = 1 + key / 8;
+		mask = 1 << (key % 8);
+	} else {
+		return;
+	}
+
+	// releases always go through, so turning the keyboard off doesn't leave keys stuck on the host
+	if (state == KEY_STATE_PRESSED) {
+		if (!tud_mounted() || !reg_is_bit_set(REG_ID_CF2, CF2_USB_KEYB_ON))
+			return;
+	} else if (state != KEY_STATE_RELEASED) {
+		return;
+	}
+
+	const uint32_t irq_state = save_and_disable_interrupts();
+
+	// while the host isn't polling, the oldest change moves into the base, losing its tap but not the key state
+	if ((uint8_t)(self.keyb_head - self.keyb_tail) == KEYB_QUEUE_SIZE) {
+		const uint8_t slot = self.keyb_tail & KEYB_QUEUE_MASK;
+
+		apply_keyb_change(self.keyb_base, self.keyb_queue[slot].idx, self.keyb_queue[slot].mask, self.keyb_queue[slot].pressed);
+		self.keyb_tail++;
+	}
+
+	const uint8_t slot = self.keyb_head & KEYB_QUEUE_MASK;
+
+	self.keyb_queue[slot].idx = idx;
+	self.keyb_queue[slot].mask = mask;
+	self.keyb_queue[slot].pressed = (state == KEY_STATE_PRESSED);
+	self.keyb_head++;
+
+	restore_interrupts(irq_state);
 
-	return USB_TASK_INTERVAL_US;
+	usb_schedule_task();
 }
 
 static void key_cb(uint8_t key, enum key_state state)
 {
-	if (tud_hid_n_ready(USB_ITF_KEYBOARD) && reg_is_bit_set(REG_ID_CF2, CF2_USB_KEYB_ON)) {
-		uint8_t keycode[6] = { 0 };
-		uint8_t modifiers = 0;
+	queue_keyb_change(key, state);
 
-		if (state == KEY_STATE_PRESSED) {
-			keycode[0] = key;
-		}
+	if (reg_is_bit_set(REG_ID_EVS, EVS_KEY))
+		push_event(EVT_KEY, key, state, 0, 0);
 
-		if (state != KEY_STATE_HOLD) {
-			tud_hid_n_keyboard_report(USB_ITF_KEYBOARD, 0, modifiers, keycode);
-		}
-	}
+	if (key != KEY_COMPOSE)
+		return;
 
-	if (tud_hid_n_ready(USB_ITF_MOUSE) && reg_is_bit_set(REG_ID_CF2, CF2_USB_MOUSE_ON)) {
-		if (key == KEY_COMPOSE) {
-			if (state == KEY_STATE_PRESSED) {
-				self.mouse_btn = MOUSE_BUTTON_LEFT;
-				self.mouse_moved = false;
-				tud_hid_n_mouse_report(USB_ITF_MOUSE, 0, MOUSE_BUTTON_LEFT, 0, 0, 0, 0);
-			} else if ((state == KEY_STATE_HOLD) && !self.mouse_moved) {
-				self.mouse_btn = MOUSE_BUTTON_RIGHT;
-				tud_hid_n_mouse_report(USB_ITF_MOUSE, 0, MOUSE_BUTTON_RIGHT, 0, 0, 0, 0);
-			} else if (state == KEY_STATE_RELEASED) {
-				self.mouse_btn = 0x00;
-				tud_hid_n_mouse_report(USB_ITF_MOUSE, 0, 0x00, 0, 0, 0, 0);
-			}
-		}
+	// only the button state changes here, the USB worker sends it, a release goes through even with the mouse off
+	if (state == KEY_STATE_RELEASED) {
+		self.mouse_btn = 0x00;
+	} else if (!tud_mounted() || !reg_is_bit_set(REG_ID_CF2, CF2_USB_MOUSE_ON)) {
+		return;
+	} else if (state == KEY_STATE_PRESSED) {
+		self.mouse_btn = MOUSE_BUTTON_LEFT;
+		self.mouse_moved = false;
+	} else if ((state == KEY_STATE_HOLD) && !self.mouse_moved) {
+		self.mouse_btn = MOUSE_BUTTON_RIGHT;
+	} else {
+		return;
 	}
+
+	usb_schedule_task();
 }
 static struct key_callback key_callback = { .func = key_cb };
 
-static void touch_cb(int8_t x, int8_t y)
+// Motion is only accumulated here, it goes out with the next report the host polls for
+static void touch_cb(int16_t x, int16_t y)
 {
-	if (!tud_hid_n_ready(USB_ITF_MOUSE) || !reg_is_bit_set(REG_ID_CF2, CF2_USB_MOUSE_ON))
+	if (reg_is_bit_set(REG_ID_EVS, EVS_TOUCH))
+		push_event(EVT_TOUCH, (uint16_t)x & 0xFF, (uint16_t)x >> 8, (uint16_t)y & 0xFF, (uint16_t)y >> 8);
+
+	if (!tud_mounted() || !reg_is_bit_set(REG_ID_CF2, CF2_USB_MOUSE_ON))
 		return;
 
 	self.mouse_moved = true;
 
-	tud_hid_n_mouse_report(USB_ITF_MOUSE, 0, self.mouse_btn, x, y, 0, 0);
+	const int32_t dx = self.mouse_x + x;
+	const int32_t dy = self.mouse_y + y;
+
+	self.mouse_x = MAX(INT16_MIN, MIN(dx, INT16_MAX));
+	self.mouse_y = MAX(INT16_MIN, MIN(dy, INT16_MAX));
+
+	// an idle endpoint raises no USB IRQ that would flush it
+	usb_schedule_task();
 }
 static struct touch_callback touch_callback = { .func = touch_cb };
 
+static void gpioexp_cb(uint8_t gpio, uint8_t gpio_idx)
+{
+	if (reg_is_bit_set(REG_ID_EVS, EVS_GPIO))
+		push_event(EVT_GPIO, gpio_idx, gpio_get(gpio), 0, 0);
+}
+static struct gpioexp_callback gpioexp_callback = { .func = gpioexp_cb };
+
 uint16_t tud_hid_get_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen)
 {
 	// TODO not Implemented
@@ -111,23 +363,118 @@ void tud_hid_set_report_cb(uint8_t itf, uint8_t report_id, hid_report_type_t rep
 	(void)len;
 }
 
+// the previous report went out, queue pending key changes and the remaining motion for the next frame
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+	(void)report;
+	(void)len;
+
+	if (instance == USB_ITF_KEYBOARD)
+		flush_keyboard();
+	else if (instance == USB_ITF_MOUSE)
+		flush_mouse();
+}
+
+static bool is_all_zero(const uint8_t *buffer, uint8_t len)
+{
+	for (uint8_t i = 0; i < len; ++i) {
+		if (buffer[i] != 0)
+			return false;
+	}
+
+	return true;
+}
+
+// A batch packet is PACKET_BATCH_MARKER, the number of accesses, then the accesses: a register for a read,
+// or a register with PACKET_WRITE_MASK and its value for a write. The reply is the marker, the number of
+// accesses that ran, then the read replies back to back. It stops at the first read that does not fit the
+// reply, the host sends the rest again.
+static void process_batch(uint8_t itf, const uint8_t *buff, uint32_t len)
+{
+	uint8_t reply[CFG_TUD_VENDOR_TX_BUFSIZE];
+	uint8_t reply_len = 2;
+	uint8_t out_len;
+
+	const uint8_t count = buff[1];
+	uint8_t done = 0;
+	uint32_t pos = 2;
+	bool deferred = false;
+
+	while ((done < count) && (pos < len)) {
+		const uint8_t reg = buff[pos];
+		const bool is_write = (reg & PACKET_WRITE_MASK);
+
+		if (is_write && ((pos + 1) >= len))
+			break;
+
+		if (!is_write && ((sizeof(reply) - reply_len) < PACKET_OUT_MAX))
+			break;
+
+		// reads see the writes that came before them in the batch
+		if (!is_write && deferred) {
+			reg_apply_writes();
+			deferred = false;
+		}
+
+		reg_process_packet(reg, is_write ? buff[pos + 1] : 0, &reply[reply_len], &out_len);
+		reply_len += out_len;
+
+		deferred |= (out_len == 0);
+		pos += is_write ? 2 : 1;
+		done++;
+	}
+
+	reply[0] = PACKET_BATCH_MARKER;
+	reply[1] = done;
+
+	tud_vendor_n_write(itf, reply, reply_len);
+}
+
 void tud_vendor_rx_cb(uint8_t itf)
 {
 //	printf("%s: itf: %d, avail: %d\r\n", __func__, itf, tud_vendor_n_available(itf));
 
 	uint8_t buff[64] = { 0 };
-	tud_vendor_n_read(itf, buff, 64);
+	const uint32_t len = tud_vendor_n_read(itf, buff, 64);
 //	printf("%s: %02X %02X %02X\r\n", __func__, buff[0], buff[1], buff[2]);
 
-	reg_process_packet(buff[0], buff[1], self.write_buffer, &self.write_len);
+	// the event stream is IN only, subscriptions go through REG_ID_EVS
+	if (itf == USB_VENDOR_EVENTS)
+		return;
+
+	if ((len >= 2) && (buff[0] == PACKET_BATCH_MARKER)) {
+		process_batch(itf, buff, len);
+		return;
+	}
+
+	uint8_t reply[CFG_TUD_VENDOR_TX_BUFSIZE];
+	uint8_t reply_len = 0;
 
-	tud_vendor_n_write(itf, self.write_buffer, self.write_len);
+	// streaming registers fill the whole reply, up to and including the first all-zero entry
+	do {
+		reg_process_packet(buff[0], buff[1], self.write_buffer, &self.write_len);
+
+		memcpy(&reply[reply_len], self.write_buffer, self.write_len);
+		reply_len += self.write_len;
+	} while (reg_is_streaming(buff[0]) && !is_all_zero(self.write_buffer, self.write_len)
+		&& ((sizeof(reply) - reply_len) >= PACKET_OUT_MAX));
+
+	tud_vendor_n_write(itf, reply, reply_len);
 }
 
 void tud_mount_cb(void)
 {
 	// Send mods over USB by default if USB connected
 	reg_set_value(REG_ID_CFG, reg_get_value(REG_ID_CFG) | CFG_REPORT_MODS);
+
+	// a new host has to subscribe to the event stream again
+	reg_set_value(REG_ID_EVS, 0);
+}
+
+// Runs tud_task() soon, for work that doesn't come with a USB IRQ or that was skipped while the mutex was held
+void usb_schedule_task(void)
+{
+	irq_set_pending(USB_LOW_PRIORITY_IRQ);
 }
 
 mutex_t *usb_get_mutex(void)
@@ -143,10 +490,14 @@ void usb_init(void)
 
 	touchpad_add_touch_callback(&touch_callback);
 
-	// create a new interrupt that calls tud_task, and trigger that interrupt from a timer
+	gpioexp_add_int_callback(&gpioexp_callback);
+
+	// create a new interrupt that calls tud_task, and trigger that interrupt from the USB IRQ
 	irq_set_exclusive_handler(USB_LOW_PRIORITY_IRQ, low_priority_worker_irq);
+	// same priority as the register worker, so a batch never applies writes while the worker is halfway through one
+	irq_set_priority(USB_LOW_PRIORITY_IRQ, PICO_LOWEST_IRQ_PRIORITY);
 	irq_set_enabled(USB_LOW_PRIORITY_IRQ, true);
 
 	mutex_init(&self.mutex);
-	add_alarm_in_us(USB_TASK_INTERVAL_US, timer_task, NULL, true);
+	irq_add_shared_handler(USBCTRL_IRQ, usb_irq, PICO_SHARED_IRQ_HANDLER_LOWEST_ORDER_PRIORITY);
 }
@@ -3,5 +3,6 @@
 typedef struct mutex mutex_t;
 
 mutex_t *usb_get_mutex(void);
+void usb_schedule_task(void);
 
 void usb_init(void);
@@ -1,6 +1,6 @@
 #include <tusb.h>
 
-#define CONFIG_TOTAL_LEN		(TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + TUD_HID_DESC_LEN + TUD_VENDOR_DESC_LEN + TUD_CDC_DESC_LEN)
+#define CONFIG_TOTAL_LEN		(TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + TUD_HID_DESC_LEN + TUD_VENDOR_DESC_LEN + TUD_VENDOR_DESC_LEN + TUD_CDC_DESC_LEN)
 
 #define EPNUM_HID_KEYBOARD		0x81
 #define EPNUM_HID_MOUSE			0x82
@@ -13,6 +13,9 @@
 #define EPNUM_CDC_IN			0x86
 #define EPNUM_CDC_OUT			0x03
 
+#define EPNUM_EVENTS_IN			0x87
+#define EPNUM_EVENTS_OUT		0x04
+
 #define CDC_CMD_MAX_SIZE		8
 #define CDC_IN_OUT_MAX_SIZE		64
 
@@ -28,6 +31,7 @@ char const *string_descriptors[] =
 	"Mouse Interface",				// 5: Interface 2 String
 	"HID Interface",				// 6: Interface 3 String
 	"CDC Interface",				// 7: Interface 4 String
+	"Event Stream Interface",		// 8: Interface 5 String
 };
 
 tusb_desc_device_t const device_descriptor =
@@ -51,9 +55,39 @@ tusb_desc_device_t const device_descriptor =
 	.bNumConfigurations	= 0x01
 };
 
+// NKRO version of TUD_HID_REPORT_DESC_KEYBOARD, the host only sees this layout in report protocol,
+// in boot protocol the keyboard sends the standard 8 byte report
 uint8_t const hid_keyboard_descriptor[] =
 {
-	TUD_HID_REPORT_DESC_KEYBOARD()
+	HID_USAGE_PAGE(HID_USAGE_PAGE_DESKTOP),
+	HID_USAGE(HID_USAGE_DESKTOP_KEYBOARD),
+	HID_COLLECTION(HID_COLLECTION_APPLICATION),
+		// modifier byte
+		HID_USAGE_PAGE(HID_USAGE_PAGE_KEYBOARD),
+		HID_USAGE_MIN(0xE0),
+		HID_USAGE_MAX(0xE7),
+		HID_LOGICAL_MIN(0),
+		HID_LOGICAL_MAX(1),
+		HID_REPORT_COUNT(8),
+		HID_REPORT_SIZE(1),
+		HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+
+		// one bit per key
+		HID_USAGE_MIN(0),
+		HID_USAGE_MAX(USB_KEYB_USAGE_COUNT - 1),
+		HID_REPORT_COUNT(USB_KEYB_USAGE_COUNT),
+		HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+
+		// LED output, same as the boot report
+		HID_USAGE_PAGE(HID_USAGE_PAGE_LED),
+		HID_USAGE_MIN(1),
+		HID_USAGE_MAX(5),
+		HID_REPORT_COUNT(5),
+		HID_OUTPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+		HID_REPORT_COUNT(1),
+		HID_REPORT_SIZE(3),
+		HID_OUTPUT(HID_CONSTANT),
+	HID_COLLECTION_END
 };
 
 uint8_t const hid_mouse_descriptor[] =
@@ -65,10 +99,11 @@ uint8_t const config_descriptor[] =
 {
 	TUD_CONFIG_DESCRIPTOR(1, USB_ITF_MAX, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, 100),
 
-	TUD_HID_DESCRIPTOR(USB_ITF_KEYBOARD,    4, HID_ITF_PROTOCOL_NONE, sizeof(hid_keyboard_descriptor), EPNUM_HID_KEYBOARD, CFG_TUD_HID_EP_BUFSIZE, 10),
-	TUD_HID_DESCRIPTOR(USB_ITF_MOUSE,       5, HID_ITF_PROTOCOL_NONE, sizeof(hid_mouse_descriptor),    EPNUM_HID_MOUSE,    CFG_TUD_HID_EP_BUFSIZE, 10),
+	TUD_HID_DESCRIPTOR(USB_ITF_KEYBOARD,    4, HID_ITF_PROTOCOL_KEYBOARD, sizeof(hid_keyboard_descriptor), EPNUM_HID_KEYBOARD, CFG_TUD_HID_EP_BUFSIZE, 1),
+	TUD_HID_DESCRIPTOR(USB_ITF_MOUSE,       5, HID_ITF_PROTOCOL_NONE, sizeof(hid_mouse_descriptor),    EPNUM_HID_MOUSE,    CFG_TUD_HID_EP_BUFSIZE, 1),
 
 	TUD_VENDOR_DESCRIPTOR(USB_ITF_VENDOR,   7, EPNUM_VENDOR_OUT, EPNUM_VENDOR_IN, CFG_TUD_VENDOR_EPSIZE),
+	TUD_VENDOR_DESCRIPTOR(USB_ITF_EVENTS,   8, EPNUM_EVENTS_OUT, EPNUM_EVENTS_IN, CFG_TUD_VENDOR_EPSIZE),
 
 	TUD_CDC_DESCRIPTOR(USB_ITF_CDC, 7, EPNUM_CDC_CMD, CDC_CMD_MAX_SIZE, EPNUM_CDC_OUT, EPNUM_CDC_IN, CDC_IN_OUT_MAX_SIZE),
 };
@@ -17,6 +17,10 @@
 #define PIN_PUPPET_SDA		28
 #define PIN_PUPPET_SCL		29
 
+// bus speeds at boot, 100kHz to 1MHz, can be changed with REG_PBR and REG_TBR
+#define PUPPET_I2C_BAUDRATE	(100 * 1000)
+#define TP_I2C_BAUDRATE		(100 * 1000)
+
 #define NUM_OF_ROWS			7
 #define PINS_ROWS \
 	1, \
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+#
+# Generates the host side register constants from the firmware register map.
+#
+# usage: etc/gen_regs.py
+#
+# Reads app/reg_map.h and the bit definitions in app/reg.h, and writes
+# etc/i2c_puppet_regs.py and etc/i2c_puppet_regs.h. Run it again after
+# changing the register map, and commit the results.
+
+import os
+import re
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+
+REG_RE = re.compile(r'X\((\w+),\s*(0x[0-9A-Fa-f]+),\s*(\d+),\s*(\w+),\s*([^,]+?),\s*(\w+),\s*(\w+),\s*"([^"]*)"\)')
+DEFINE_RE = re.compile(r'^#define\s+((?:CFG|CF2|DEB|INT|TXY|ERR|EVS|EVT|KEY|DIR|PUD|I2C_SPEED)_\w+|PACKET_\w+)\s+(.+?)\s*(?://\s*(.*))?$')
+
+HEADER = 'generated by etc/gen_regs.py from app/reg_map.h and app/reg.h, do not edit'
+
+
+def read(path):
+    with open(os.path.join(ROOT, path)) as f:
+        return f.read()
+
+
+def write(path, lines):
+    with open(os.path.join(ROOT, path), 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+
+
+def parse():
+    regs = [m.groups() for m in REG_RE.finditer(read('app/reg_map.h'))]
+    defines = [m.groups() for m in map(DEFINE_RE.match, read('app/reg.h').splitlines()) if m]
+
+    return regs, defines
+
+
+def gen_python(regs, defines):
+    lines = ['# ' + HEADER, '']
+
+    for name, addr, width, access, flags, rd, wr, desc in regs:
+        lines.append('%-20s = %s  # %s' % ('REG_' + name, addr, desc))
+
+    lines += ['', 'REG_WIDTH = {']
+    for name, addr, width, access, flags, rd, wr, desc in regs:
+        lines.append('    %-18s %s,' % ('REG_' + name + ':', width))
+    lines += ['}', '']
+
+    for name, value, desc in defines:
+        lines.append(('%-20s = %s' % (name, value)) + ('  # ' + desc if desc else ''))
+
+    write('etc/i2c_puppet_regs.py', lines)
+
+
+def gen_c(regs, defines):
+    lines = ['// ' + HEADER, '', '#pragma once', '']
+
+    for name, addr, width, access, flags, rd, wr, desc in regs:
+        lines.append('#define %-24s %s // %s' % ('REG_' + name, addr, desc))
+
+    lines.append('')
+    for name, addr, width, access, flags, rd, wr, desc in regs:
+        lines.append('#define %-24s %s' % ('REG_' + name + '_WIDTH', width))
+
+    lines.append('')
+    for name, value, desc in defines:
+        lines.append(('#define %-24s %s' % (name, value)) + (' // ' + desc if desc else ''))
+
+    write('etc/i2c_puppet_regs.h', lines)
+
+
+if __name__ == '__main__':
+    regs, defines = parse()
+
+    gen_python(regs, defines)
+    gen_c(regs, defines)
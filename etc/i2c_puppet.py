@@ -1,61 +1,7 @@
+import struct
 import usb
 
-
-_REG_VER = 0x01  # fw version
-_REG_CFG = 0x02  # config
-_REG_INT = 0x03  # interrupt status
-_REG_KEY = 0x04  # key status
-_REG_BKL = 0x05  # backlight
-_REG_DEB = 0x06  # debounce cfg
-_REG_FRQ = 0x07  # poll freq cfg
-_REG_RST = 0x08  # reset
-_REG_FIF = 0x09  # fifo
-_REG_BK2 = 0x0A  # backlight 2
-_REG_DIR = 0x0B  # gpio direction
-_REG_PUE = 0x0C  # gpio input pull enable
-_REG_PUD = 0x0D  # gpio input pull direction
-_REG_GIO = 0x0E  # gpio value
-_REG_GIC = 0x0F  # gpio interrupt config
-_REG_GIN = 0x10  # gpio interrupt status
-_REG_HLD = 0x11  # key hold time cfg (in 10ms units)
-_REG_ADR = 0x12  # i2c puppet address
-_REG_IND = 0x13  # interrupt pin assert duration
-_REG_CF2 = 0x14  # config 2
-_REG_TOX = 0x15  # touch delta x since last read, at most (-128 to 127)
-_REG_TOY = 0x16  # touch delta y since last read, at most (-128 to 127)
-
-_WRITE_MASK      = 1 << 7
-
-CFG_OVERFLOW_ON  = 1 << 0
-CFG_OVERFLOW_INT = 1 << 1
-CFG_CAPSLOCK_INT = 1 << 2
-CFG_NUMLOCK_INT  = 1 << 3
-CFG_KEY_INT      = 1 << 4
-CFG_PANIC_INT    = 1 << 5
-CFG_REPORT_MODS  = 1 << 6
-CFG_USE_MODS     = 1 << 7
-
-CF2_TOUCH_INT    = 1 << 0
-CF2_USB_KEYB_ON  = 1 << 1
-CF2_USB_MOUSE_ON = 1 << 2
-
-INT_OVERFLOW     = 1 << 0
-INT_CAPSLOCK     = 1 << 1
-INT_NUMLOCK      = 1 << 2
-INT_KEY          = 1 << 3
-INT_PANIC        = 1 << 4
-INT_GPIO         = 1 << 5
-INT_TOUCH        = 1 << 6
-
-KEY_CAPSLOCK     = 1 << 5
-KEY_NUMLOCK      = 1 << 6
-KEY_COUNT_MASK   = 0x1F
-
-DIR_OUTPUT       = 0
-DIR_INPUT        = 1
-
-PUD_DOWN         = 0
-PUD_UP           = 1
+from i2c_puppet_regs import *
 
 
 class I2CPuppet:
@@ -67,38 +13,120 @@ class I2CPuppet:
             raise Exception('Device with vid:pid %04X:%04X not found!' % (vid, pid))
 
         conf = self._dev.get_active_configuration()
-        itf = usb.util.find_descriptor(conf, bInterfaceClass=usb.CLASS_VENDOR_SPEC)
+        itfs = sorted(usb.util.find_descriptor(conf, find_all=True, bInterfaceClass=usb.CLASS_VENDOR_SPEC),
+                      key=lambda i: i.bInterfaceNumber)
+
+        if not itfs:
+            raise Exception('Vendor interface not found!')
 
-        self._ep_out = usb.util.find_descriptor(itf, custom_match=lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_OUT)
-        self._ep_in = usb.util.find_descriptor(itf, custom_match=lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_IN)
+        # the first vendor interface is for register accesses, the second one is the event stream
+        self._ep_out = self._find_endpoint(itfs[0], usb.util.ENDPOINT_OUT)
+        self._ep_in = self._find_endpoint(itfs[0], usb.util.ENDPOINT_IN)
+        self._ep_events = self._find_endpoint(itfs[1], usb.util.ENDPOINT_IN) if len(itfs) > 1 else None
 
         if (self._ep_out is None) or (self._ep_in is None):
             raise Exception('Vendor IN or OUT endpoint not found!')
 
+    @staticmethod
+    def _find_endpoint(itf, direction):
+        return usb.util.find_descriptor(itf, custom_match=lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == direction)
+
     @property
     def version(self):
-        ver = self._read_register(_REG_VER)
+        ver = self._read_register(REG_VER)
         return (ver >> 4, ver & 0x0F)
 
     @property
     def status(self):
-        return self._read_register(_REG_KEY)
+        return self._read_register(REG_KEY)
 
     @property
     def backlight(self):
-        return self._read_register(_REG_BKL) / 255
+        return self._read_register(REG_BKL) / 255
 
     @backlight.setter
     def backlight(self, value):
-        self._write_register(_REG_BKL, int(255 * value))
+        self._write_register(REG_BKL, int(255 * value))
 
     @property
     def address(self):
-        return self._read_register(_REG_ADR)
+        return self._read_register(REG_ADR)
 
     @address.setter
     def address(self, value):
-        self._write_register(_REG_ADR, value)
+        self._write_register(REG_ADR, value)
+
+    def batch(self, accesses):
+        """Runs many register accesses in as few USB round trips as possible.
+
+        Every access is (reg,) for a read or (reg, value) for a write, and they run in order.
+        Returns a list with the reply bytes of every read, and None for every write.
+        """
+        results = []
+        pending = list(accesses)
+
+        while pending:
+            packet = bytearray([PACKET_BATCH_MARKER, 0])
+
+            for access in pending[:255]:
+                if len(access) == 1:
+                    data = bytes([access[0]])
+                else:
+                    data = bytes([access[0] | PACKET_WRITE_MASK, access[1] & 0xFF])
+
+                if len(packet) + len(data) > self._ep_out.wMaxPacketSize:
+                    break
+
+                packet += data
+                packet[1] += 1
+
+            self._dev.write(self._ep_out, packet)
+            reply = self._dev.read(self._ep_in, self._ep_in.wMaxPacketSize)
+
+            if (len(reply) < 2) or (reply[0] != PACKET_BATCH_MARKER) or (reply[1] == 0):
+                raise Exception('Malformed batch reply!')
+
+            pos = 2
+            for access in pending[:reply[1]]:
+                if len(access) == 1:
+                    width = REG_WIDTH.get(access[0], 0)
+                    results.append(bytes(reply[pos:pos + width]))
+                    pos += width
+                else:
+                    results.append(None)
+
+            pending = pending[reply[1]:]
+
+        return results
+
+    def events(self, subscribe=EVS_KEY | EVS_TOUCH | EVS_GPIO, timeout=0):
+        """Subscribes to the event stream and yields (seq, type, data) tuples as events happen.
+
+        data is (key, state) for EVT_KEY, (x, y) for EVT_TOUCH and (gpio index, value) for EVT_GPIO.
+        seq counts up by one per record, a gap means records were dropped.
+        The subscription ends when the generator is closed.
+        """
+        if self._ep_events is None:
+            raise Exception('Event stream endpoint not found!')
+
+        self._write_register(REG_EVS, subscribe)
+
+        try:
+            while True:
+                packet = self._dev.read(self._ep_events, self._ep_events.wMaxPacketSize, timeout)
+
+                for pos in range(0, len(packet) - EVT_RECORD_LEN + 1, EVT_RECORD_LEN):
+                    kind, seq = packet[pos], packet[pos + 1]
+                    raw = bytes(packet[pos + 2:pos + EVT_RECORD_LEN])
+
+                    if kind == EVT_TOUCH:
+                        data = struct.unpack('<hh', raw)
+                    else:
+                        data = (raw[0], raw[1])
+
+                    yield seq, kind, data
+        finally:
+            self._write_register(REG_EVS, 0)
 
     def _read_register(self, reg):
         self._buffer[0] = reg
@@ -107,7 +135,7 @@ class I2CPuppet:
         return self._dev.read(self._ep_in, 1)[0]
 
     def _write_register(self, reg, value):
-        self._buffer[0] = reg | _WRITE_MASK
+        self._buffer[0] = reg | PACKET_WRITE_MASK
         self._buffer[1] = value
         self._dev.write(self._ep_out, self._buffer)
 
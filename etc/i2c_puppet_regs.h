@@ -0,0 +1,154 @@
+// generated by etc/gen_regs.py from app/reg_map.h and app/reg.h, do not edit
+
+#pragma once
+
+#define REG_VER                  0x01 // fw version
+#define REG_CFG                  0x02 // config
+#define REG_INT                  0x03 // interrupt status
+#define REG_KEY                  0x04 // key status
+#define REG_BKL                  0x05 // backlight
+#define REG_DEB                  0x06 // key debounce cfg
+#define REG_FRQ                  0x07 // key poll freq cfg, sets both SMN and SMX
+#define REG_RST                  0x08 // trigger a reset
+#define REG_FIF                  0x09 // key fifo
+#define REG_BK2                  0x0A // backlight 2
+#define REG_DIR                  0x0B // gpio direction
+#define REG_PUE                  0x0C // gpio input pull enable
+#define REG_PUD                  0x0D // gpio input pull direction
+#define REG_GIO                  0x0E // gpio value
+#define REG_GIC                  0x0F // gpio interrupt config
+#define REG_GIN                  0x10 // gpio interrupt status
+#define REG_HLD                  0x11 // key hold time cfg (in 10ms units)
+#define REG_ADR                  0x12 // i2c puppet address
+#define REG_IND                  0x13 // interrupt pin assert duration
+#define REG_CF2                  0x14 // config 2
+#define REG_TOX                  0x15 // touch delta x since last read, at most (-128 to 127)
+#define REG_TOY                  0x16 // touch delta y since last read, at most (-128 to 127)
+#define REG_ADC                  0x17 // battery voltage, raw 12-bit ADC value
+#define REG_LED                  0x20 // LED on/off
+#define REG_LED_R                0x21 // LED red value
+#define REG_LED_G                0x22 // LED green value
+#define REG_LED_B                0x23 // LED blue value
+#define REG_REWAKE_TIME          0x24 // power on the Pi in this many minutes
+#define REG_REWAKE               0x25 // write to shut off Pi, power on after REWAKE_TIME
+#define REG_RTC_SEC              0x26 // rtc seconds
+#define REG_RTC_MIN              0x27 // rtc minutes
+#define REG_RTC_HOUR             0x28 // rtc hours
+#define REG_RTC_MDAY             0x29 // rtc day of the month
+#define REG_RTC_MON              0x2A // rtc month
+#define REG_RTC_YEAR             0x2B // rtc years since 1900
+#define REG_RTC_COMMIT           0x2C // set the rtc to the RTC_* values
+#define REG_DRIVER_STATE         0x2D // set when driver is loaded / unloaded cleanly
+#define REG_IDL                  0x2E // key scan idle timeout (in 10ms units, 0 to always scan)
+#define REG_SMN                  0x2F // fastest key scan interval (in 100us units)
+#define REG_SMX                  0x30 // slowest key scan interval (in 100us units)
+#define REG_SCI                  0x31 // current key scan interval (in 100us units)
+#define REG_FTS                  0x32 // key fifo with timestamps
+#define REG_FBR                  0x33 // key fifo burst, every read request pops the next entry
+#define REG_SNP                  0x34 // status snapshot: INT, KEY, TOX, TOY and GIN in one read
+#define REG_IGP                  0x35 // minimum gap between two interrupts (in ms)
+#define REG_IDY                  0x36 // longest an event may wait for its interrupt (in ms)
+#define REG_ICT                  0x37 // pending events that trigger an interrupt right away (0 to disable)
+#define REG_PBR                  0x38 // i2c puppet bus speed (in 10kHz units)
+#define REG_TBR                  0x39 // touchpad i2c bus speed (in 10kHz units)
+#define REG_TXY                  0x3A // touch delta x and y since last read, 16-bit each, and TXY_* flags
+#define REG_EVS                  0x3B // usb event stream subscription, EVS_* bits
+#define REG_ERR                  0x3C // errors since last read, ERR_* bits
+
+#define REG_VER_WIDTH            1
+#define REG_CFG_WIDTH            1
+#define REG_INT_WIDTH            1
+#define REG_KEY_WIDTH            1
+#define REG_BKL_WIDTH            1
+#define REG_DEB_WIDTH            1
+#define REG_FRQ_WIDTH            1
+#define REG_RST_WIDTH            0
+#define REG_FIF_WIDTH            2
+#define REG_BK2_WIDTH            1
+#define REG_DIR_WIDTH            1
+#define REG_PUE_WIDTH            1
+#define REG_PUD_WIDTH            1
+#define REG_GIO_WIDTH            1
+#define REG_GIC_WIDTH            1
+#define REG_GIN_WIDTH            1
+#define REG_HLD_WIDTH            1
+#define REG_ADR_WIDTH            1
+#define REG_IND_WIDTH            1
+#define REG_CF2_WIDTH            1
+#define REG_TOX_WIDTH            1
+#define REG_TOY_WIDTH            1
+#define REG_ADC_WIDTH            2
+#define REG_LED_WIDTH            1
+#define REG_LED_R_WIDTH          1
+#define REG_LED_G_WIDTH          1
+#define REG_LED_B_WIDTH          1
+#define REG_REWAKE_TIME_WIDTH    1
+#define REG_REWAKE_WIDTH         0
+#define REG_RTC_SEC_WIDTH        1
+#define REG_RTC_MIN_WIDTH        1
+#define REG_RTC_HOUR_WIDTH       1
+#define REG_RTC_MDAY_WIDTH       1
+#define REG_RTC_MON_WIDTH        1
+#define REG_RTC_YEAR_WIDTH       1
+#define REG_RTC_COMMIT_WIDTH     0
+#define REG_DRIVER_STATE_WIDTH   1
+#define REG_IDL_WIDTH            1
+#define REG_SMN_WIDTH            1
+#define REG_SMX_WIDTH            1
+#define REG_SCI_WIDTH            1
+#define REG_FTS_WIDTH            6
+#define REG_FBR_WIDTH            2
+#define REG_SNP_WIDTH            5
+#define REG_IGP_WIDTH            1
+#define REG_IDY_WIDTH            1
+#define REG_ICT_WIDTH            1
+#define REG_PBR_WIDTH            1
+#define REG_TBR_WIDTH            1
+#define REG_TXY_WIDTH            5
+#define REG_EVS_WIDTH            1
+#define REG_ERR_WIDTH            1
+
+#define CFG_OVERFLOW_ON          (1 << 0) // Should new FIFO entries overwrite oldest ones if FIFO is full
+#define CFG_OVERFLOW_INT         (1 << 1) // Should FIFO overflow generate an interrupt
+#define CFG_CAPSLOCK_INT         (1 << 2) // Should toggling caps lock generate interrupts
+#define CFG_NUMLOCK_INT          (1 << 3) // Should toggling num lock generate interrupts
+#define CFG_KEY_INT              (1 << 4) // Should key events generate interrupts
+#define CFG_PANIC_INT            (1 << 5) // Not implemented
+#define CFG_REPORT_MODS          (1 << 6) // Should Alt, Sym and Shifts be reported as well
+#define CFG_USE_MODS             (1 << 7) // Should Alt, Sym and Shifts modify the keys reported
+#define CF2_TOUCH_INT            (1 << 0) // Should touch events generate interrupts
+#define CF2_USB_KEYB_ON          (1 << 1) // Should key events be sent over USB HID
+#define CF2_USB_MOUSE_ON         (1 << 2) // Should touch events be sent over USB HID
+#define CF2_SNAPSHOT_CLR         (1 << 3) // Should reading REG_ID_SNP clear the INT and GIN bits it returned
+#define CF2_INT_LEVEL            (1 << 4) // Should INT stay asserted while an interrupt is pending, reads clear what they return
+#define DEB_EAGER                (1 << 7) // Report the first edge right away and ignore the bounces after it
+#define DEB_TIME_MASK            0x7F // Debounce time in ms
+#define INT_OVERFLOW             (1 << 0)
+#define INT_CAPSLOCK             (1 << 1)
+#define INT_NUMLOCK              (1 << 2)
+#define INT_KEY                  (1 << 3)
+#define INT_PANIC                (1 << 4)
+#define INT_GPIO                 (1 << 5)
+#define INT_TOUCH                (1 << 6)
+#define TXY_OVERFLOW             (1 << 0) // A delta did not fit in 16 bits and was clamped
+#define ERR_WRITE_DROPPED        (1 << 0) // A write came in while the write queue was full and was ignored
+#define EVS_KEY                  (1 << 0) // Should key events be pushed on the USB event stream
+#define EVS_TOUCH                (1 << 1) // Should touch events be pushed on the USB event stream
+#define EVS_GPIO                 (1 << 2) // Should GPIO interrupts be pushed on the USB event stream
+#define EVT_RECORD_LEN           6 // Event stream record: type, sequence number, then 4 bytes of data
+#define EVT_KEY                  0x01 // Data: key, state
+#define EVT_TOUCH                0x02 // Data: x and y deltas, 16-bit little-endian each
+#define EVT_GPIO                 0x03 // Data: GPIO index, pin value
+#define KEY_CAPSLOCK             (1 << 5) // Caps lock status
+#define KEY_NUMLOCK              (1 << 6) // Num lock status
+#define KEY_COUNT_MASK           0x1F
+#define DIR_OUTPUT               0
+#define DIR_INPUT                1
+#define PUD_DOWN                 0
+#define PUD_UP                   1
+#define I2C_SPEED_UNIT           (10 * 1000)
+#define I2C_SPEED_MIN            10 // standard mode, 100kHz
+#define I2C_SPEED_MAX            100 // fast mode plus, 1MHz
+#define PACKET_WRITE_MASK        (1 << 7)
+#define PACKET_OUT_MAX           6 // longest reply to a single register read
+#define PACKET_BATCH_MARKER      0x00 // first byte of a batch of accesses over USB, there is no register 0
@@ -0,0 +1,154 @@
+# generated by etc/gen_regs.py from app/reg_map.h and app/reg.h, do not edit
+
+REG_VER              = 0x01  # fw version
+REG_CFG              = 0x02  # config
+REG_INT              = 0x03  # interrupt status
+REG_KEY              = 0x04  # key status
+REG_BKL              = 0x05  # backlight
+REG_DEB              = 0x06  # key debounce cfg
+REG_FRQ              = 0x07  # key poll freq cfg, sets both SMN and SMX
+REG_RST              = 0x08  # trigger a reset
+REG_FIF              = 0x09  # key fifo
+REG_BK2              = 0x0A  # backlight 2
+REG_DIR              = 0x0B  # gpio direction
+REG_PUE              = 0x0C  # gpio input pull enable
+REG_PUD              = 0x0D  # gpio input pull direction
+REG_GIO              = 0x0E  # gpio value
+REG_GIC              = 0x0F  # gpio interrupt config
+REG_GIN              = 0x10  # gpio interrupt status
+REG_HLD              = 0x11  # key hold time cfg (in 10ms units)
+REG_ADR              = 0x12  # i2c puppet address
+REG_IND              = 0x13  # interrupt pin assert duration
+REG_CF2              = 0x14  # config 2
+REG_TOX              = 0x15  # touch delta x since last read, at most (-128 to 127)
+REG_TOY              = 0x16  # touch delta y since last read, at most (-128 to 127)
+REG_ADC              = 0x17  # battery voltage, raw 12-bit ADC value
+REG_LED              = 0x20  # LED on/off
+REG_LED_R            = 0x21  # LED red value
+REG_LED_G            = 0x22  # LED green value
+REG_LED_B            = 0x23  # LED blue value
+REG_REWAKE_TIME      = 0x24  # power on the Pi in this many minutes
+REG_REWAKE           = 0x25  # write to shut off Pi, power on after REWAKE_TIME
+REG_RTC_SEC          = 0x26  # rtc seconds
+REG_RTC_MIN          = 0x27  # rtc minutes
+REG_RTC_HOUR         = 0x28  # rtc hours
+REG_RTC_MDAY         = 0x29  # rtc day of the month
+REG_RTC_MON          = 0x2A  # rtc month
+REG_RTC_YEAR         = 0x2B  # rtc years since 1900
+REG_RTC_COMMIT       = 0x2C  # set the rtc to the RTC_* values
+REG_DRIVER_STATE     = 0x2D  # set when driver is loaded / unloaded cleanly
+REG_IDL              = 0x2E  # key scan idle timeout (in 10ms units, 0 to always scan)
+REG_SMN              = 0x2F  # fastest key scan interval (in 100us units)
+REG_SMX              = 0x30  # slowest key scan interval (in 100us units)
+REG_SCI              = 0x31  # current key scan interval (in 100us units)
+REG_FTS              = 0x32  # key fifo with timestamps
+REG_FBR              = 0x33  # key fifo burst, every read request pops the next entry
+REG_SNP              = 0x34  # status snapshot: INT, KEY, TOX, TOY and GIN in one read
+REG_IGP              = 0x35  # minimum gap between two interrupts (in ms)
+REG_IDY              = 0x36  # longest an event may wait for its interrupt (in ms)
+REG_ICT              = 0x37  # pending events that trigger an interrupt right away (0 to disable)
+REG_PBR              = 0x38  # i2c puppet bus speed (in 10kHz units)
+REG_TBR              = 0x39  # touchpad i2c bus speed (in 10kHz units)
+REG_TXY              = 0x3A  # touch delta x and y since last read, 16-bit each, and TXY_* flags
+REG_EVS              = 0x3B  # usb event stream subscription, EVS_* bits
+REG_ERR              = 0x3C  # errors since last read, ERR_* bits
+
+REG_WIDTH = {
+    REG_VER:           1,
+    REG_CFG:           1,
+    REG_INT:           1,
+    REG_KEY:           1,
+    REG_BKL:           1,
+    REG_DEB:           1,
+    REG_FRQ:           1,
+    REG_RST:           0,
+    REG_FIF:           2,
+    REG_BK2:           1,
+    REG_DIR:           1,
+    REG_PUE:           1,
+    REG_PUD:           1,
+    REG_GIO:           1,
+    REG_GIC:           1,
+    REG_GIN:           1,
+    REG_HLD:           1,
+    REG_ADR:           1,
+    REG_IND:           1,
+    REG_CF2:           1,
+    REG_TOX:           1,
+    REG_TOY:           1,
+    REG_ADC:           2,
+    REG_LED:           1,
+    REG_LED_R:         1,
+    REG_LED_G:         1,
+    REG_LED_B:         1,
+    REG_REWAKE_TIME:   1,
+    REG_REWAKE:        0,
+    REG_RTC_SEC:       1,
+    REG_RTC_MIN:       1,
+    REG_RTC_HOUR:      1,
+    REG_RTC_MDAY:      1,
+    REG_RTC_MON:       1,
+    REG_RTC_YEAR:      1,
+    REG_RTC_COMMIT:    0,
+    REG_DRIVER_STATE:  1,
+    REG_IDL:           1,
+    REG_SMN:           1,
+    REG_SMX:           1,
+    REG_SCI:           1,
+    REG_FTS:           6,
+    REG_FBR:           2,
+    REG_SNP:           5,
+    REG_IGP:           1,
+    REG_IDY:           1,
+    REG_ICT:           1,
+    REG_PBR:           1,
+    REG_TBR:           1,
+    REG_TXY:           5,
+    REG_EVS:           1,
+    REG_ERR:           1,
+}
+
+CFG_OVERFLOW_ON      = (1 << 0)  # Should new FIFO entries overwrite oldest ones if FIFO is full
+CFG_OVERFLOW_INT     = (1 << 1)  # Should FIFO overflow generate an interrupt
+CFG_CAPSLOCK_INT     = (1 << 2)  # Should toggling caps lock generate interrupts
+CFG_NUMLOCK_INT      = (1 << 3)  # Should toggling num lock generate interrupts
+CFG_KEY_INT          = (1 << 4)  # Should key events generate interrupts
+CFG_PANIC_INT        = (1 << 5)  # Not implemented
+CFG_REPORT_MODS      = (1 << 6)  # Should Alt, Sym and Shifts be reported as well
+CFG_USE_MODS         = (1 << 7)  # Should Alt, Sym and Shifts modify the keys reported
+CF2_TOUCH_INT        = (1 << 0)  # Should touch events generate interrupts
+CF2_USB_KEYB_ON      = (1 << 1)  # Should key events be sent over USB HID
+CF2_USB_MOUSE_ON     = (1 << 2)  # Should touch events be sent over USB HID
+CF2_SNAPSHOT_CLR     = (1 << 3)  # Should reading REG_ID_SNP clear the INT and GIN bits it returned
+CF2_INT_LEVEL        = (1 << 4)  # Should INT stay asserted while an interrupt is pending, reads clear what they return
+DEB_EAGER            = (1 << 7)  # Report the first edge right away and ignore the bounces after it
+DEB_TIME_MASK        = 0x7F  # Debounce time in ms
+INT_OVERFLOW         = (1 << 0)
+INT_CAPSLOCK         = (1 << 1)
+INT_NUMLOCK          = (1 << 2)
+INT_KEY              = (1 << 3)
+INT_PANIC            = (1 << 4)
+INT_GPIO             = (1 << 5)
+INT_TOUCH            = (1 << 6)
+TXY_OVERFLOW         = (1 << 0)  # A delta did not fit in 16 bits and was clamped
+ERR_WRITE_DROPPED    = (1 << 0)  # A write came in while the write queue was full and was ignored
+EVS_KEY              = (1 << 0)  # Should key events be pushed on the USB event stream
+EVS_TOUCH            = (1 << 1)  # Should touch events be pushed on the USB event stream
+EVS_GPIO             = (1 << 2)  # Should GPIO interrupts be pushed on the USB event stream
+EVT_RECORD_LEN       = 6  # Event stream record: type, sequence number, then 4 bytes of data
+EVT_KEY              = 0x01  # Data: key, state
+EVT_TOUCH            = 0x02  # Data: x and y deltas, 16-bit little-endian each
+EVT_GPIO             = 0x03  # Data: GPIO index, pin value
+KEY_CAPSLOCK         = (1 << 5)  # Caps lock status
+KEY_NUMLOCK          = (1 << 6)  # Num lock status
+KEY_COUNT_MASK       = 0x1F
+DIR_OUTPUT           = 0
+DIR_INPUT            = 1
+PUD_DOWN             = 0
+PUD_UP               = 1
+I2C_SPEED_UNIT       = (10 * 1000)
+I2C_SPEED_MIN        = 10  # standard mode, 100kHz
+I2C_SPEED_MAX        = 100  # fast mode plus, 1MHz
+PACKET_WRITE_MASK    = (1 << 7)
+PACKET_OUT_MAX       = 6  # longest reply to a single register read
+PACKET_BATCH_MARKER  = 0x00  # first byte of a batch of accesses over USB, there is no register 0
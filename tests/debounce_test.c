@@ -0,0 +1,179 @@
+// Replays bouncy key traces through the debouncer and checks the events it reports.
+// Builds on the host, see tests/CMakeLists.txt.
+
+#include "debounce.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define KEY_A		(1ull << 0)
+#define KEY_B		(1ull << 37)
+
+static int failures;
+
+// A trace has one character per scan, '1' while the contact is closed.
+// The events come back as "+n" for a press and "-n" for a release, n being the scan it was reported on.
+static void replay(const char *trace_a, const char *trace_b, uint16_t scans, bool eager, char *events_a, char *events_b)
+{
+	uint64_t prev = 0;
+	size_t i;
+
+	// a single scan in deferred mode with a 1 scan period takes the raw state and clears the counters
+	debounce_update(0, 1, false);
+
+	events_a[0] = '\0';
+	events_b[0] = '\0';
+
+	for (i = 0; trace_a[i] || (trace_b && trace_b[i]); ++i) {
+		uint64_t raw = 0;
+
+		if (trace_a[i] == '1')
+			raw |= KEY_A;
+
+		if (trace_b && (trace_b[i] == '1'))
+			raw |= KEY_B;
+
+		const uint64_t state = debounce_update(raw, scans, eager);
+
+		if ((state ^ prev) & KEY_A)
+			sprintf(events_a + strlen(events_a), "%c%zu", (state & KEY_A) ? '+' : '-', i);
+
+		if ((state ^ prev) & KEY_B)
+			sprintf(events_b + strlen(events_b), "%c%zu", (state & KEY_B) ? '+' : '-', i);
+
+		prev = state;
+	}
+}
+
+static void check(const char *name, const char *events, const char *expected)
+{
+	if (strcmp(events, expected) == 0)
+		return;
+
+	printf("%s: got \"%s\", expected \"%s\"\n", name, events, expected);
+	failures++;
+}
+
+static void test_deferred_press_bounce(void)
+{
+	char a[64], b[64];
+
+	// the press is reported once it was seen on 3 scans in a row
+	replay("0010110111100", NULL, 3, false, a, b);
+	check(__func__, a, "+9");
+}
+
+static void test_deferred_release_bounce(void)
+{
+	char a[64], b[64];
+
+	replay("11111101001000000", NULL, 3, false, a, b);
+	check(__func__, a, "+2-13");
+}
+
+static void test_deferred_held_through_bounce(void)
+{
+	char a[64], b[64];
+
+	// single scan dropouts while the key is held are not reported
+	replay("1111101111011110111", NULL, 3, false, a, b);
+	check(__func__, a, "+2");
+	check("settled after a held key", debounce_is_settled() ? "yes" : "no", "yes");
+}
+
+static void test_eager_press_bounce(void)
+{
+	char a[64], b[64];
+
+	// the first edge goes out right away, the bounces during the lockout are ignored
+	replay("0101011111", NULL, 4, true, a, b);
+	check(__func__, a, "+1");
+}
+
+static void test_eager_release_bounce(void)
+{
+	char a[64], b[64];
+
+	replay("11110101000000", NULL, 4, true, a, b);
+	check(__func__, a, "+0-4");
+}
+
+static void test_eager_vs_deferred(void)
+{
+	char eager[64], deferred[64], b[64];
+	const char *trace = "0101111110100000";
+
+	// same trace, eager reports each edge on its first scan, deferred once it settled
+	replay(trace, NULL, 4, true, eager, b);
+	replay(trace, NULL, 4, false, deferred, b);
+
+	check("eager", eager, "+1-9");
+	check("deferred", deferred, "+6-14");
+}
+
+static void test_eager_lockout_expires(void)
+{
+	char a[64], b[64];
+
+	// a bounce that lasts longer than the lockout shows up as another edge
+	replay("1001100000", NULL, 2, true, a, b);
+	check(__func__, a, "+0-2+4-6");
+}
+
+static void test_deferred_shorter_period(void)
+{
+	int i;
+
+	// the period goes down while a key is halfway through a longer one, the next scan reports it
+	debounce_update(0, 1, false);
+
+	for (i = 0; i < 3; ++i)
+		debounce_update(KEY_A, 8, false);
+
+	check(__func__, (debounce_update(KEY_A, 2, false) & KEY_A) ? "pressed" : "released", "pressed");
+}
+
+static void test_long_period(void)
+{
+	char trace[3000], a[64], b[64];
+
+	// 127ms at a 100us scan interval, a dropout halfway through starts the count over
+	memset(trace, '1', sizeof(trace) - 1);
+	trace[sizeof(trace) - 1] = '\0';
+	trace[1200] = '0';
+
+	replay(trace, NULL, 1270, false, a, b);
+	check(__func__, a, "+2470");
+
+	replay(trace, NULL, 1200, false, a, b);
+	check("period ending before the dropout", a, "+1199");
+}
+
+static void test_independent_keys(void)
+{
+	char a[64], b[64];
+
+	// one key held steady while another one bounces next to it
+	replay("1111111111111", "0010110111100", 3, false, a, b);
+	check("held key", a, "+2");
+	check("bouncing key", b, "+9");
+}
+
+int main(void)
+{
+	test_deferred_press_bounce();
+	test_deferred_release_bounce();
+	test_deferred_held_through_bounce();
+	test_eager_press_bounce();
+	test_eager_release_bounce();
+	test_eager_vs_deferred();
+	test_eager_lockout_expires();
+	test_deferred_shorter_period();
+	test_long_period();
+	test_independent_keys();
+
+	if (failures)
+		printf("%d failure(s)\n", failures);
+
+	return failures ? 1 : 0;
+}